@@ -0,0 +1,385 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file pv_gateway.cpp
+  * 
+  * Local UDP gateway for the dashboard (PV_SOURCE_UDP in Config.h).
+  *
+  * Answers every PG_REQUEST with the current PV record (a delta if the
+  * dashboard has the previous snapshot of this epoch) followed by the 
+  * weather record, and optionally sends both as multicast beacon. The 
+  * epoch is the start time of the gateway, the sequence numbers start 
+  * there too, so they never repeat after a restart.
+  *
+  * Build: g++ -O2 -I../pv_dashboard -o pv_gateway pv_gateway.cpp
+  * Usage: pv_gateway pv.json [-p port] [-m group port seconds] [-w command seconds]
+  *
+  * pv.json is the output of the PV script (the keys of GetHTTPValues) and
+  * is reloaded when it changes. The weather command prints the onecall json
+  * of openweathermap, e.g. curl -s with the url of Weather::GetOpenWeather,
+  * it runs every seconds and its output is parsed by WeatherJsonHandler like
+  * on the dashboard. test/datagram_loopback.cpp runs the gateway on the 
+  * loopback interface.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "PVRecord.h"
+#include "PVDatagram.h"
+#include "WeatherJson.h"
+
+/**
+  * State of the gateway.
+  */
+struct Gateway
+{
+   PVValues      current;         //!< Current snapshot
+   PVValues      previous;        //!< Snapshot before the current one
+   uint32_t      seq;             //!< Sequence number of the current snapshot
+   uint32_t      epoch;           //!< Start time of the gateway
+   time_t        pvModified;      //!< mtime of the loaded pv.json
+   const char   *pvFile;          //!< Path of pv.json
+   const char   *weatherCommand;  //!< Command which prints the onecall json or NULL
+   int           weatherInterval; //!< Seconds between two weather commands
+   time_t        weatherFetched;  //!< Time of the last weather command
+   WeatherRecord weather;         //!< Parsed weather record
+   uint32_t      weatherSeq;      //!< Number of the weather records with a changed body
+   bool          hasWeather;      //!< weather is valid
+};
+
+/**
+  * Output of the weather command for the JsonParser, with the CRC32 of the read bytes.
+  */
+class PipeStream : public Stream
+{
+public:
+   FILE    *pipe; //!< Output of the command
+   uint32_t hash; //!< CRC32 of the bytes read so far
+
+   PipeStream(FILE *source)
+      : pipe(source)
+      , hash(0)
+   {
+   }
+
+   size_t readBytes(char *buffer, size_t length) override
+   {
+      size_t len = fread(buffer, 1, length, pipe);
+
+      hash = Crc32(buffer, len, hash);
+      return len;
+   }
+};
+
+/* Parse a json string value, pos points behind the opening quote. */
+static const char *ParseString(const char *pos, char *value, size_t size)
+{
+   size_t len = 0;
+
+   while (*pos && *pos != '"') {
+      if (*pos == '\\' && pos[1]) pos++;
+      if (len + 1 < size) value[len++] = *pos;
+      pos++;
+   }
+   value[len] = 0;
+   return *pos ? pos + 1 : pos;
+}
+
+/* Store one key/value pair of the flat PV json into values. */
+static void SetJsonValue(PVValues &values, const char *key, double number, const char *string, const float *array, int count)
+{
+   int field = PVFieldOfKey(key);
+
+   if (field < 0) {
+      return;
+   }
+   switch (pvSchema[field].type) {
+      case PV_TYPE_NUMBER:
+         values.scalar[field] = string ? atof(string) : number;
+         break;
+      case PV_TYPE_STATE:
+         if (!string) return;
+         snprintf(values.fveState, sizeof(values.fveState), "%s", string);
+         break;
+      case PV_TYPE_HISTORY:
+         if (!array) return;
+         memset(PVValuesHistory(values, field), 0, sizeof(float) * MAX_PV_HISTORY);
+         memcpy(PVValuesHistory(values, field), array, sizeof(float) * count);
+         break;
+   }
+   values.mask |= 1UL << field;
+}
+
+/* Parse the flat PV json object with numbers, strings and number arrays. */
+static bool ParsePVJson(const char *json, PVValues &values)
+{
+   const char *pos = strchr(json, '{');
+
+   memset(&values, 0, sizeof(values));
+   if (!pos) {
+      return false;
+   }
+   pos++;
+   while (*pos) {
+      char key[64];
+      char string[64];
+
+      while (*pos && *pos != '"' && *pos != '}') pos++;
+      if (*pos != '"') break;
+      pos = ParseString(pos + 1, key, sizeof(key));
+      while (*pos && (isspace(*pos) || *pos == ':')) pos++;
+
+      if (*pos == '"') {
+         pos = ParseString(pos + 1, string, sizeof(string));
+         SetJsonValue(values, key, 0, string, NULL, 0);
+      } else if (*pos == '[') {
+         float array[MAX_PV_HISTORY];
+         int   count = 0;
+
+         pos++;
+         while (*pos && *pos != ']') {
+            char *end;
+            float v = strtof(pos, &end);
+
+            if (end == pos) {
+               pos++;
+               continue;
+            }
+            if (count < MAX_PV_HISTORY) array[count++] = v;
+            pos = end;
+         }
+         if (*pos) pos++;
+         SetJsonValue(values, key, 0, NULL, array, count);
+      } else {
+         char *end;
+         double v = strtod(pos, &end);
+
+         if (end == pos) {
+            while (*pos && *pos != ',' && *pos != '}') pos++; // true, false, null
+         } else {
+            SetJsonValue(values, key, v, NULL, NULL, 0);
+            pos = end;
+         }
+      }
+   }
+   return values.mask != 0;
+}
+
+/* Reload pv.json when it changed. */
+static void Reload(Gateway &gw)
+{
+   struct stat st;
+
+   if (stat(gw.pvFile, &st) == 0 && st.st_mtime != gw.pvModified) {
+      FILE    *file = fopen(gw.pvFile, "rb");
+      char     json[8192];
+      size_t   len  = file ? fread(json, 1, sizeof(json) - 1, file) : 0;
+      PVValues values;
+
+      if (file) fclose(file);
+      json[len] = 0;
+      gw.pvModified = st.st_mtime;
+      if (ParsePVJson(json, values)) {
+         uint8_t a[PV_RECORD_MAX_SIZE];
+         uint8_t b[PV_RECORD_MAX_SIZE];
+         size_t  lenA, lenB;
+
+         values.mask    = PV_ALL_FIELDS;
+         values.seq     = gw.seq;
+         values.baseSeq = 0;
+         lenA = PVRecordEncode(values,     a, sizeof(a));
+         lenB = PVRecordEncode(gw.current, b, sizeof(b));
+         if (gw.current.seq == 0 || lenA != lenB || memcmp(a, b, lenA) != 0) {
+            gw.previous = gw.current;
+            gw.current  = values;
+            gw.current.seq = ++gw.seq;
+            printf("pv snapshot %u\n", gw.seq);
+         }
+      }
+   }
+}
+
+/* Run the weather command and parse its onecall json into the weather record. */
+static void FetchWeather(Gateway &gw)
+{
+   FILE *pipe = popen(gw.weatherCommand, "r");
+
+   gw.weatherFetched = time(NULL);
+   if (!pipe) {
+      perror("popen");
+      return;
+   }
+   WeatherRecord      record;
+   PipeStream         body(pipe);
+   WeatherJsonHandler handler(record, true);
+   JsonParser         parser(body, handler);
+
+   memset(&record, 0, sizeof(record));
+   bool ok = parser.Parse();
+
+   while (fgetc(pipe) != EOF) {
+      // the command writes until its end
+   }
+   if (pclose(pipe) != 0 || !ok) {
+      printf("weather command failed\n");
+      return;
+   }
+   handler.Finish();
+   record.forecastHash = body.hash;
+   if (!gw.hasWeather || record.forecastHash != gw.weather.forecastHash) {
+      gw.weather    = record;
+      gw.hasWeather = true;
+      printf("weather record %u\n", ++gw.weatherSeq);
+   }
+}
+
+/* Record for a dashboard with the snapshot haveSeq of this epoch: delta, full or nothing new. */
+static size_t EncodePV(Gateway &gw, uint32_t haveSeq, uint8_t *buf, size_t size)
+{
+   PVValues values = gw.current;
+
+   values.mask    = PV_ALL_FIELDS;
+   values.baseSeq = 0;
+   if (haveSeq == gw.seq) {
+      values.mask    = 0;
+      values.baseSeq = haveSeq;
+   } else if (haveSeq != 0 && haveSeq == gw.previous.seq) {
+      uint8_t a[8], b[8];
+
+      values.mask    = 0;
+      values.baseSeq = haveSeq;
+      for (int field = 0; field < PV_FIELD_COUNT; field++) {
+         const PVFieldSchema &schema  = pvSchema[field];
+         bool                 changed = false;
+
+         if (schema.type == PV_TYPE_NUMBER) {
+            PVPutFixed(a, schema.bytes, gw.current.scalar[field],  schema.scale);
+            PVPutFixed(b, schema.bytes, gw.previous.scalar[field], schema.scale);
+            changed = memcmp(a, b, schema.bytes) != 0;
+         } else if (schema.type == PV_TYPE_STATE) {
+            changed = strcmp(gw.current.fveState, gw.previous.fveState) != 0;
+         } else {
+            changed = memcmp(PVValuesHistory(gw.current, field), PVValuesHistory(gw.previous, field), sizeof(float) * MAX_PV_HISTORY) != 0;
+         }
+         if (changed) values.mask |= 1UL << field;
+      }
+   }
+   uint8_t record[PV_RECORD_MAX_SIZE];
+   size_t  len = PVRecordEncode(values, record, sizeof(record));
+
+   return PGEncode(buf, size, PG_PV, gw.seq, gw.epoch, record, len);
+}
+
+/* Send the PV datagram and the weather datagram. */
+static void SendSnapshot(int sock, Gateway &gw, uint32_t haveSeq, const sockaddr_in &to)
+{
+   uint8_t buf[PG_MAX_DATAGRAM];
+   size_t  len = EncodePV(gw, haveSeq, buf, sizeof(buf));
+
+   sendto(sock, buf, len, 0, (const sockaddr *) &to, sizeof(to));
+   if (gw.hasWeather) {
+      len = PGEncode(buf, sizeof(buf), PG_WEATHER, gw.weatherSeq, gw.epoch, (const uint8_t *) &gw.weather, sizeof(gw.weather));
+      sendto(sock, buf, len, 0, (const sockaddr *) &to, sizeof(to));
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   Gateway     gw;
+   int         port       = 4210;
+   const char *group      = NULL;
+   int         groupPort  = 4211;
+   int         interval   = 0;
+   time_t      lastBeacon = 0;
+
+   memset(&gw, 0, sizeof(gw));
+   gw.epoch = (uint32_t) time(NULL);
+   gw.seq   = gw.epoch;
+   setvbuf(stdout, NULL, _IOLBF, 0);
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s pv.json [-p port] [-m group port seconds] [-w command seconds]\n", argv[0]);
+      return 1;
+   }
+   gw.pvFile = argv[1];
+   for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+         port = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-m") == 0 && i + 3 < argc) {
+         group     = argv[++i];
+         groupPort = atoi(argv[++i]);
+         interval  = atoi(argv[++i]);
+      } else if (strcmp(argv[i], "-w") == 0 && i + 2 < argc) {
+         gw.weatherCommand  = argv[++i];
+         gw.weatherInterval = atoi(argv[++i]);
+      }
+   }
+
+   int         sock = socket(AF_INET, SOCK_DGRAM, 0);
+   sockaddr_in addr;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port        = htons(port);
+   if (sock < 0 || bind(sock, (sockaddr *) &addr, sizeof(addr)) < 0) {
+      perror("bind");
+      return 1;
+   }
+   printf("pv_gateway listening on %d, epoch %u\n", port, gw.epoch);
+
+   for (;;) {
+      fd_set  fds;
+      timeval timeout = { 1, 0 };
+
+      FD_ZERO(&fds);
+      FD_SET(sock, &fds);
+      Reload(gw);
+      if (gw.weatherCommand && time(NULL) - gw.weatherFetched >= gw.weatherInterval) {
+         FetchWeather(gw);
+      }
+      if (select(sock + 1, &fds, NULL, NULL, &timeout) > 0) {
+         uint8_t     buf[PG_MAX_DATAGRAM];
+         sockaddr_in from;
+         socklen_t   fromLen = sizeof(from);
+         ssize_t     len     = recvfrom(sock, buf, sizeof(buf), 0, (sockaddr *) &from, &fromLen);
+         PGHeader    header;
+
+         if (len > 0 && PGDecode(buf, len, header) && header.type == PG_REQUEST && gw.current.seq) {
+            SendSnapshot(sock, gw, header.epoch == gw.epoch ? header.seq : 0, from);
+         }
+      }
+      if (group && interval > 0 && gw.current.seq && time(NULL) - lastBeacon >= interval) {
+         sockaddr_in to;
+
+         memset(&to, 0, sizeof(to));
+         to.sin_family      = AF_INET;
+         to.sin_addr.s_addr = inet_addr(group);
+         to.sin_port        = htons(groupPort);
+         SendSnapshot(sock, gw, 0, to);
+         lastBeacon = time(NULL);
+      }
+   }
+   return 0;
+}
@@ -28,6 +28,53 @@
 
 #define URL     "http://LINK TO YOUR SCRIPT"
 
+//#define PV_SOURCE_MQTT                 // read the PV values from the MQTT broker instead of URL
+#define MQTT_SERVER      "YOUR BROKER"
+#define MQTT_PORT        1883
+#define MQTT_USER        ""
+#define MQTT_PW          ""
+#define MQTT_CLIENT      "m5paper-pv"
+#define MQTT_TIMEOUT     3000            // ms to wait for the retained messages
+
+// change to your topics, the retained topic of every PVField
+#define MQTT_TOPICS(X) \
+   X("huawei/active_power",          PV_PANEL_POWER    ) \
+   X("huawei/daily_yield_energy",    PV_YIELD_TODAY    ) \
+   X("huawei/day_active_power_peak", PV_PV_PEAK        ) \
+   X("huawei/pv_01_voltage",         PV_PV1_VOLTAGE    ) \
+   X("huawei/pv_01_current",         PV_PV1_CURRENT    ) \
+   X("huawei/pv_02_voltage",         PV_PV2_VOLTAGE    ) \
+   X("huawei/pv_02_current",         PV_PV2_CURRENT    ) \
+   X("huawei/state",                 PV_FVE_STATE      ) \
+   X("shelly/huawei/power",          PV_POWER          ) \
+   X("shelly/boiler/status",         PV_BOILER_STATUS  ) \
+   X("shelly/boiler/power",          PV_BOILER_POWER   ) \
+   X("shelly/boiler/water",          PV_BOILER_WATER   ) \
+   X("meter/active_power",           PV_GRID_POWER     ) \
+   X("meter/l1/power",               PV_GRID_L1_POWER  ) \
+   X("meter/l1/voltage",             PV_GRID_L1_VOLTAGE) \
+   X("meter/l1/current",             PV_GRID_L1_CURRENT) \
+   X("meter/l2/power",               PV_GRID_L2_POWER  ) \
+   X("meter/l2/voltage",             PV_GRID_L2_VOLTAGE) \
+   X("meter/l2/current",             PV_GRID_L2_CURRENT) \
+   X("meter/l3/power",               PV_GRID_L3_POWER  ) \
+   X("meter/l3/voltage",             PV_GRID_L3_VOLTAGE) \
+   X("meter/l3/current",             PV_GRID_L3_CURRENT) \
+   X("home/gas",                     PV_GAS            ) \
+   X("home/water",                   PV_WATER          ) \
+   X("home/power",                   PV_ELEKTRIKA      ) \
+   X("home/temp",                    PV_TEMP           ) \
+   X("stats/power_history",          PV_HISTORY_POWER  ) \
+   X("stats/yeld_history",           PV_HISTORY_YELD   )
+
+//#define PV_SOURCE_UDP                  // read the PV snapshot (and the weather) from the local UDP gateway
+#define UDP_GATEWAY      "192.168.1.10"
+#define UDP_GATEWAY_PORT 4210
+#define UDP_PORT         4211            // local port for the answers and beacons
+//#define UDP_MULTICAST  "239.0.0.42"    // wait for a gateway beacon instead of sending a request
+#define UDP_TIMEOUT      500             // ms to wait for the datagrams
+#define UDP_WEATHER_WAIT 20              // ms to wait for the weather datagram behind the PV datagram
+
 #define CITY_NAME        "YOUR CITY"
 
 // change to your location
@@ -36,4 +83,27 @@
 
 #define OPENWEATHER_SRV  "api.openweathermap.org"
 #define OPENWEATHER_PORT 80
-#define OPENWEATHER_API  "YOUR API KEY"
\ No newline at end of file
+#define OPENWEATHER_API  "YOUR API KEY"
+
+#define WEATHER_FORECAST_TTL (3 * 60 * 60) // seconds the cached onecall forecast is used
+#define WEATHER_CURRENT_TTL  (30 * 60)     // seconds until the current conditions are refreshed
+#define FULL_REFRESH_INTERVAL (6 * 60 * 60) // seconds between full GC16 refreshes of the panel
+
+#define WAKE_INTERVAL      (10 * 60) // seconds between two wakes
+#define WAKE_INTERVAL_MIN  ( 5 * 60) // seconds between two wakes while the power is volatile
+#define WAKE_INTERVAL_MAX  (20 * 60) // seconds between two wakes while the power is steady
+#define VOLATILE_POWER     300       // W change per 10 minutes for the short interval
+#define STEADY_POWER       50        // W change per 10 minutes for the long interval
+#define NIGHT_MARGIN       (30 * 60) // seconds before sunrise and after sunset still counted as day
+#define NIGHT_SUMMARY      true      // wake once at sunset + NIGHT_MARGIN before sleeping through the night
+#define OFFLINE_MAX_INTERVAL (2 * 60 * 60) // longest retry interval while the wifi is not reachable
+#define WAKE_MODE          2         // 0 shutdown (cold boot), 1 deep sleep (warm wake), 2 the mode with the lower measured battery drop
+#define NTP_SYNC_INTERVAL  (6 * 60 * 60) // seconds between two NTP syncs on warm wakes
+
+#define WAKE_BUDGET        30000     // ms of one wake until all network phases give up
+#define BUDGET_WIFI        10000     // ms slice to connect the wifi
+#define BUDGET_NTP          2000     // ms slice for the NTP time
+#define BUDGET_PV           6000     // ms slice for the PV values
+#define BUDGET_WEATHER      8000     // ms slice for the weather request(s)
+#define BUDGET_RENDER       6000     // ms slice for the display update (only measured)
+#define WAKE_ARENA_SIZE    (96 * 1024) // bytes for the transient buffers of a wake, in the PSRAM if available
@@ -0,0 +1,39 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file Crc32.h
+  * 
+  * CRC32 checksum of the records and the datagrams.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC32 (IEEE 802.3) of a memory block, could be chained with the previous crc. */
+uint32_t Crc32(const void *data, size_t len, uint32_t crc = 0)
+{
+   const uint8_t *p = (const uint8_t *) data;
+
+   crc = ~crc;
+   while (len--) {
+      crc ^= *p++;
+      for (int i = 0; i < 8; i++) {
+         crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+   }
+   return ~crc;
+}
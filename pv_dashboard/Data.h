@@ -23,91 +23,149 @@
 
 #include "Utils.h"
 #include "weather.h"
-#include <nvs.h>
+#include "PVRecord.h"
+#include "PVSnapshot.h"
+#include "HistoryData.h"
+#include "EnergyData.h"
+#include "NVSRecord.h"
 
-#define CHARGE_HISTORY_SIZE 725
-#define PPV_HISTORY_SIZE    725
-#define GRID_HISTORY_SIZE   320
+#define PPV_HISTORY_BLOCKS    4 // compressed raw blocks of 264 bytes, about 2-3 days of samples
+#define GRID_HISTORY_BLOCKS   4
+#define BOILER_HISTORY_BLOCKS 2 // the temperature changes slowly
 #define MAX_FORECAST  8
 
+#define COUNTER_RECORD_KEY     "nvsCounter"
+#define COUNTER_RECORD_VERSION 1
+
 const DateTime EmptyDateTime(2000, 1, 1, 0, 0, 0);
 
+#define PV_HUAWEI_MEMBER(field, member, type, ...) PV_HUAWEI_##type(member)
+#define PV_HUAWEI_NUMBER(member)  double  member;
+#define PV_HUAWEI_STATE(member)   uint8_t member;
+#define PV_HUAWEI_HISTORY(member) float   member[MAX_PV_HISTORY];
+#define PV_HUAWEI_CLEAR(field, member, ...) memset(&member, 0, sizeof(member));
+
+/**
+  * The PV values, one member of every PV_SCHEMA row.
+  */
 class Huawei
 {
 public:   
-   double      voltage;     
-   double      ampere;       
-   double      power;        
-   double      grid_power; 
-   DateTime    lastChange;   
-   double      boiler_status;
-   double      boiler_power;
-   double      boiler_water;
-   double      grid_l1_power;
-   double      grid_l1_voltage;
-   double      grid_l1_current;
-   double      grid_l2_power;
-   double      grid_l2_voltage;
-   double      grid_l2_current;
-   double      grid_l3_power;
-   double      grid_l3_voltage;
-   double      grid_l3_current;
-   double      pv1_voltage;
-   double      pv1_current;
-   double      pv2_voltage;
-   double      pv2_current;
-   double      pv_peak;
-   double      gas;
-   double      water;
-   double      elektrika;
-   double      temp;
-   String      fve_state;
-   String      alive;        
-   float       historyPower[MAX_FORECAST];
-   int         maxPower;
-   float       historyYeld[MAX_FORECAST];
-   int         maxYeld;
-   double      panelPower;
-   double      yieldToday;
+   PV_SCHEMA(PV_HUAWEI_MEMBER)
+   int         maxPower;     //!< Maximum of historyPower
+   int         maxYeld;      //!< Maximum of historyYeld
 
 public:
    Huawei()
-      : voltage(0.0)
-      , ampere(0.0)
-      , power(0.0)
-      , grid_power(0.0)
-      , lastChange(EmptyDateTime)
-      , boiler_status(0.0)
-      , boiler_power(0.0)
-      , boiler_water(0.0)
-      , grid_l1_power(0.0)
-      , grid_l1_voltage(0.0)
-      , grid_l1_current(0.0)
-      , grid_l2_power(0.0)
-      , grid_l2_voltage(0.0)
-      , grid_l2_current(0.0)
-      , grid_l3_power(0.0)
-      , grid_l3_voltage(0.0)
-      , grid_l3_current(0.0)
-      , pv1_voltage(0.0)
-      , pv1_current(0.0)
-      , pv2_voltage(0.0)
-      , pv2_current(0.0)
-      , pv_peak(0.0)
-      , gas(0.0)
-      , water(0.0)
-      , elektrika(0.0)
-      , temp(0.0)
-      , maxPower(0)
+      : maxPower(0)
       , maxYeld(0)
-      , panelPower(0.0)
-      , yieldToday(0.0)
    {
+      PV_SCHEMA(PV_HUAWEI_CLEAR)
    }
 
-   void Dump();
+   void     Dump();
+   void     UpdateMax();
+   void     ToSnapshot(PVSnapshot &snapshot) const;
+   void     FromSnapshot(const PVSnapshot &snapshot);
+   uint32_t Diff(const PVSnapshot &snapshot) const;
+};
+
+static_assert(FVE_UNKNOWN == 0, "Huawei clears fve_state to FVE_UNKNOWN");
+
+typedef float PVHistory[MAX_PV_HISTORY];
+
+#define PV_SCALAR_MEMBER(field, member, type, ...) PV_SCALAR_MEMBER_##type(member)
+#define PV_SCALAR_MEMBER_NUMBER(member)  &Huawei::member,
+#define PV_SCALAR_MEMBER_STATE(member)
+#define PV_SCALAR_MEMBER_HISTORY(member)
+
+#define PV_HISTORY_MEMBER(field, member, type, ...) PV_HISTORY_MEMBER_##type(member)
+#define PV_HISTORY_MEMBER_NUMBER(member)  NULL,
+#define PV_HISTORY_MEMBER_STATE(member)   NULL,
+#define PV_HISTORY_MEMBER_HISTORY(member) &Huawei::member,
+
+/* Huawei member of every scalar PVField. */
+static double Huawei::* const pvScalarMember[PV_SCALAR_COUNT] = 
+{
+   PV_SCHEMA(PV_SCALAR_MEMBER)
 };
 
+/* Huawei member of every history PVField, NULL for the other types. */
+static PVHistory Huawei::* const pvHistoryMember[PV_FIELD_COUNT] = 
+{
+   PV_SCHEMA(PV_HISTORY_MEMBER)
+};
+
+/* helper function to dump all the PV values */
+void Huawei::Dump()
+{
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      const PVFieldSchema &schema   = pvSchema[field];
+      int                  decimals = schema.scale >= 100 ? 2 : (schema.scale >= 10 ? 1 : 0);
+      String               text     = String(schema.key) + ": ";
+
+      if (schema.type == PV_TYPE_NUMBER) {
+         text += String(this->*pvScalarMember[field], decimals);
+      } else if (schema.type == PV_TYPE_STATE) {
+         text += FveStateName(fve_state);
+      } else {
+         for (int i = 0; i < MAX_PV_HISTORY; i++) {
+            text += String(i ? "," : "") + String((this->*pvHistoryMember[field])[i], decimals);
+         }
+      }
+      if (*schema.unit) {
+         text += String(" ") + schema.unit;
+      }
+      Serial.println(text);
+   }
+}
+
+/* Recompute the graph maxima of the histories. */
+void Huawei::UpdateMax()
+{
+   maxPower = 0;
+   maxYeld  = 0;
+   for (int i = 0; i < MAX_PV_HISTORY; i++) {
+      maxPower = max(maxPower, (int) historyPower[i]);
+      maxYeld  = max(maxYeld,  (int) historyYeld[i]);
+   }
+}
+
+/* Store the values in the packed fixed point snapshot. */
+void Huawei::ToSnapshot(PVSnapshot &snapshot) const
+{
+   memset(&snapshot, 0, sizeof(snapshot));
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      switch (pvSchema[field].type) {
+         case PV_TYPE_NUMBER:  PVSnapshotSet(snapshot, field, this->*pvScalarMember[field]);         break;
+         case PV_TYPE_STATE:   PVSnapshotSet(snapshot, field, fve_state);                            break;
+         case PV_TYPE_HISTORY: PVSnapshotSetHistory(snapshot, field, this->*pvHistoryMember[field]); break;
+      }
+   }
+}
+
+/* Take over the values of a snapshot. */
+void Huawei::FromSnapshot(const PVSnapshot &snapshot)
+{
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      switch (pvSchema[field].type) {
+         case PV_TYPE_NUMBER:  this->*pvScalarMember[field] = PVSnapshotGet(snapshot, field);        break;
+         case PV_TYPE_STATE:   fve_state = (uint8_t) PVSnapshotGet(snapshot, field);                 break;
+         case PV_TYPE_HISTORY: PVSnapshotGetHistory(snapshot, field, this->*pvHistoryMember[field]); break;
+      }
+   }
+   UpdateMax();
+}
+
+/* Mask of the PVFields which differ from the snapshot in its fixed point resolution. */
+uint32_t Huawei::Diff(const PVSnapshot &snapshot) const
+{
+   PVSnapshot current;
+
+   ToSnapshot(current);
+   return PVSnapshotDiff(snapshot, current);
+}
+
 /**
   * Class for collecting all the global data.
   */
@@ -123,8 +181,15 @@ public:
    int          sht30Humidity;    //!< SHT30 humidity
 
    Huawei       huawei;     //!< The Tasmota Elite data
+   uint32_t     pvChanged;        //!< Mask of the PVFields changed in this wake
+   time_t       staleSince;       //!< Time of the last online update if offline, otherwise 0
    Weather      weather;          //!< All the openweathermap data
 
+   HistoryData  panelHistory;     //!< Intraday panel power
+   HistoryData  gridHistory;      //!< Intraday grid power
+   HistoryData  boilerHistory;    //!< Intraday boiler water temperature
+   EnergyData   energy;           //!< Energy statistics integrated over the wakes
+
 public:
    MyData()
       : wifiRSSI(0)
@@ -132,12 +197,19 @@ public:
       , batteryCapacity(0)
       , sht30Temperatur(0)
       , sht30Humidity(0)
+      , pvChanged(0)
+      , staleSince(0)
+      , panelHistory ("h_panel",  PPV_HISTORY_BLOCKS,     1, "W")
+      , gridHistory  ("h_grid",   GRID_HISTORY_BLOCKS,    1, "W")
+      , boilerHistory("h_boiler", BOILER_HISTORY_BLOCKS, 10, "C")
+      , energy("energy")
    {
    }
 
    void Dump();
    void LoadNVS();
    void SaveNVS();
+   void RecordHistory();
 };
 
 
@@ -151,26 +223,61 @@ void MyData::Dump()
    Serial.println("BatteryCapacity: "  + String(batteryCapacity));
    Serial.println("Sht30Temperatur: "  + String(sht30Temperatur));
    Serial.println("Sht30Humidity: "    + String(sht30Humidity));
-   
+   huawei.Dump();
+}
+
+/* Append the values of this wake to the persistent histories */
+void MyData::RecordHistory()
+{
+   time_t now = GetRTCTime();
+
+   panelHistory.Load();
+   gridHistory.Load();
+   boilerHistory.Load();
+   panelHistory.Append (now, huawei.panelPower);
+   gridHistory.Append  (now, huawei.grid_power);
+   boilerHistory.Append(now, huawei.boiler_water);
+   panelHistory.Save();
+   gridHistory.Save();
+   boilerHistory.Save();
+   Serial.printf("History: %d samples in %u bytes, panel %.0f..%.0f W\n", 
+      panelHistory.Count(), panelHistory.UsedBytes(), panelHistory.Min(), panelHistory.Max());
+
+   energy.Load();
+   energy.Add(now, huawei.panelPower, huawei.grid_power, huawei.boiler_power, huawei.elektrika, huawei.yieldToday);
+   energy.Save();
+   energy.Dump();
 }
 
 /* Load the NVS data from the non volatile memory */
 void MyData::LoadNVS()
 {
    nvs_handle nvs_arg;
-   nvs_open("Setting", NVS_READONLY, &nvs_arg);
-   nvs_get_u16(nvs_arg, "nvsCounter", &nvsCounter);
-   nvs_close(nvs_arg);
+
+   if (LoadNVSRecord(COUNTER_RECORD_KEY, COUNTER_RECORD_VERSION, &nvsCounter, sizeof(nvsCounter))) {
+      return;
+   }
+   nvsCounter = 0;
+   // the counter of the older firmware was a u16 under the same key, take it over once
+   if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_arg) == ESP_OK) {
+      bool legacy = nvs_get_u16(nvs_arg, COUNTER_RECORD_KEY, &nvsCounter) == ESP_OK;
+
+      if (legacy) {
+         nvs_erase_key(nvs_arg, COUNTER_RECORD_KEY);
+         nvs_commit(nvs_arg);
+      }
+      nvs_close(nvs_arg);
+      if (legacy) {
+         Serial.printf("nvsCounter %u taken over from the u16 entry\n", nvsCounter);
+         SaveNVS();
+      }
+   }
 }
 
 /* Store the NVS data to the non volatile memory */
 void MyData::SaveNVS()
 {
-   nvs_handle nvs_arg;
-   nvs_open("Setting", NVS_READWRITE, &nvs_arg);
-   nvs_set_u16(nvs_arg, "nvsCounter", nvsCounter);
-   nvs_commit(nvs_arg);
-   nvs_close(nvs_arg);
+   SaveNVSRecord(COUNTER_RECORD_KEY, COUNTER_RECORD_VERSION, &nvsCounter, sizeof(nvsCounter));
 }
 
 
@@ -22,10 +22,97 @@
 #pragma once
 #include "Data.h"
 #include "Icons.h"
+#include "PVRecord.h"
+#include "NVSRecord.h"
+#include "RefreshPolicy.h"
 
+#define DISPLAY_RECORD_KEY     "display"
+#define DISPLAY_RECORD_VERSION 1
 
 M5EPD_Canvas canvas(&M5.EPD); // Main canvas of the e-paper
 
+/**
+  * Independently refreshable areas of the dashboard.
+  */
+enum Widget
+{
+   WIDGET_HEAD,        //!< Version, update time, rssi and battery
+   WIDGET_PV_INFO,     //!< PV string voltages, currents, peak and state
+   WIDGET_SOLAR,       //!< Solar symbol with the panel power and yield
+   WIDGET_GRID_INFO,   //!< L1, L2, L3 and total
+   WIDGET_BOILER,      //!< Boiler symbol and boiler power
+   WIDGET_INVERTER,    //!< Inverter house connection
+   WIDGET_GRID,        //!< House grid connection
+   WIDGET_CONSUMPTION, //!< Consumption line and the graphs
+   WIDGET_COUNT
+};
+
+#define WIDGET_ALL ((uint32_t) ((1UL << WIDGET_COUNT) - 1))
+
+/* Screen area of a widget. */
+struct WidgetArea
+{
+   int x;
+   int y;
+   int dx;
+   int dy;
+};
+
+/* Screen areas of all widgets, see DrawHead() and DrawBody(). */
+static const WidgetArea widgetArea[WIDGET_COUNT] = 
+{
+   {  14,   0, 932,  34 }, // WIDGET_HEAD
+   {  24,  44, 250, 166 }, // WIDGET_PV_INFO
+   { 290,  64, 150, 160 }, // WIDGET_SOLAR
+   { 450,  44, 486, 166 }, // WIDGET_GRID_INFO
+   {  80, 230, 215, 100 }, // WIDGET_BOILER
+   { 425, 230, 110, 100 }, // WIDGET_INVERTER
+   { 665, 230, 110, 100 }, // WIDGET_GRID
+   {  14, 345, 932, 175 }, // WIDGET_CONSUMPTION
+};
+
+/* Widget which shows the PVField. */
+static const uint8_t pvFieldWidget[PV_FIELD_COUNT] = 
+{
+   WIDGET_SOLAR,       // PV_PANEL_POWER
+   WIDGET_SOLAR,       // PV_YIELD_TODAY
+   WIDGET_INVERTER,    // PV_POWER
+   WIDGET_GRID,        // PV_GRID_POWER
+   WIDGET_BOILER,      // PV_BOILER_STATUS
+   WIDGET_BOILER,      // PV_BOILER_POWER
+   WIDGET_BOILER,      // PV_BOILER_WATER
+   WIDGET_GRID_INFO,   // PV_GRID_L1_POWER
+   WIDGET_GRID_INFO,   // PV_GRID_L1_VOLTAGE
+   WIDGET_GRID_INFO,   // PV_GRID_L1_CURRENT
+   WIDGET_GRID_INFO,   // PV_GRID_L2_POWER
+   WIDGET_GRID_INFO,   // PV_GRID_L2_VOLTAGE
+   WIDGET_GRID_INFO,   // PV_GRID_L2_CURRENT
+   WIDGET_GRID_INFO,   // PV_GRID_L3_POWER
+   WIDGET_GRID_INFO,   // PV_GRID_L3_VOLTAGE
+   WIDGET_GRID_INFO,   // PV_GRID_L3_CURRENT
+   WIDGET_PV_INFO,     // PV_PV1_VOLTAGE
+   WIDGET_PV_INFO,     // PV_PV1_CURRENT
+   WIDGET_PV_INFO,     // PV_PV2_VOLTAGE
+   WIDGET_PV_INFO,     // PV_PV2_CURRENT
+   WIDGET_PV_INFO,     // PV_PV_PEAK
+   WIDGET_CONSUMPTION, // PV_GAS
+   WIDGET_CONSUMPTION, // PV_WATER
+   WIDGET_CONSUMPTION, // PV_ELEKTRIKA
+   WIDGET_COUNT,       // PV_TEMP (not shown)
+   WIDGET_PV_INFO,     // PV_FVE_STATE
+   WIDGET_CONSUMPTION, // PV_HISTORY_POWER
+   WIDGET_CONSUMPTION, // PV_HISTORY_YELD
+};
+
+/**
+  * What the panel shows after the last refresh.
+  */
+struct DisplayState
+{
+   uint32_t lastFullRefresh; //!< RTC time of the last full GC16 refresh
+   uint8_t  dashboard;       //!< The panel shows the dashboard (not an error screen)
+};
+
 /* Main class for drawing the content to the e-paper display. */
 class SolarDisplay
 {
@@ -44,7 +131,7 @@ protected:
    void   DrawHeadUpdated       (int x, int y);
    void   DrawHeadRSSI          (int x, int y);
    void   DrawHeadBattery       (int x, int y);
-   void   DrawBody              (int x, int y, int dx, int dy);
+   void   DrawBody              (int x, int y, int dx, int dy, uint32_t widgets);
    void   DrawBatteryInfo       (int x, int y, int dx, int dy);
    void   DrawSolarSymbol       (int x, int y, int dx, int dy);
    void   DrawSolarArrow        (int x, int y, int dx, int dy);
@@ -57,6 +144,9 @@ protected:
    void   DrawGridArrow         (int x, int y, int dx, int dy);
    void   DrawGridSymbol        (int x, int y, int dx, int dy);
    void   DrawSolarInfo         (int x, int y, int dx, int dy);
+   void   UpdateWidgets         (uint32_t widgets);
+   void   SaveState             (bool dashboard, bool fullRefresh);
+   void   SaveShown             (uint32_t widgets);
 
 public:
    SolarDisplay(MyData &md, int x = 960, int y = 540)
@@ -66,8 +156,9 @@ public:
    {
    }
 
-   void Show();
-   void ShowWiFiError(String ssid);
+   uint32_t DirtyWidgets();
+   void     Show(uint32_t widgets = WIDGET_ALL);
+   void     ShowWiFiError(String ssid);
 };
 
 /* Draw a circle with optional start and end point */
@@ -182,6 +273,13 @@ void SolarDisplay::DrawHeadVersion(int x, int y)
 /* Draw the information when are these data updated. */
 void SolarDisplay::DrawHeadUpdated(int x, int y)
 {
+   if (myData.staleSince) {
+      String staleString = "Offline - stale since " + getHourMinString(myData.staleSince);
+
+      canvas.drawCentreString(staleString, x, y, 1);
+      canvas.drawRect(x - 170, y - 6, 340, 28, M5EPD_Canvas::G15);
+      return;
+   }
    String updatedString = "Updated " + getDateTimeString(GetRTCTime());
    
    canvas.drawCentreString(updatedString, x, y, 1);
@@ -235,7 +333,7 @@ void SolarDisplay::DrawBatteryInfo(int x, int y, int dx, int dy)
    canvas.drawString("PV2 Current:", x +   5, y +  84); canvas.drawString(pv2current,                x +   170, y +  84);
 
    canvas.drawString("PV PowerPeak:", x +   5, y +  114); canvas.drawString(powerpeak,                x +   170, y +  114);
-   canvas.drawString(String(myData.huawei.fve_state), x +   5, y +  134); 
+   canvas.drawString(FveStateName(myData.huawei.fve_state), x +   5, y +  134); 
 
    DrawIcon(x + dx - 34, y + dy - 34, (uint16_t *) image_data_SolarIconSmall, 30, 30);
 }
@@ -462,27 +560,125 @@ void SolarDisplay::DrawHead(int x, int y, int dx, int dy)
    DrawHeadBattery  (x + dx -  49,  y + 11);
 }
 
-/* Draw the whole solar information body. */
-void SolarDisplay::DrawBody(int x, int y, int dx, int dy)
+/* Draw the solar information body, only the given widgets and the static symbols with WIDGET_ALL. */
+void SolarDisplay::DrawBody(int x, int y, int dx, int dy, uint32_t widgets)
 {
    canvas.drawRect(x, y, dx, dy, M5EPD_Canvas::G15);
 
-   DrawBatteryInfo    (x +  10, y +  10, 250, 166);
-   DrawSolarSymbol    (x + 276, y +  30, 150, 150);
-   DrawSolarArrow     (x + 346, y + 140,  50,  50);
-   DrawGridInfo       (x + 436, y +  10, 486, 166);
-   DrawBatterySymbol  (x +  96, y + 196,  60, 100);
-   DrawBatteryArrow   (x + 171, y + 196, 110, 100);
-   DrawInverterSymbol (x + 296, y + 196, 100, 100);
-   DrawInverterArrow  (x + 411, y + 196, 110, 100);
-   DrawHouseSymbol    (x + 536, y + 196, 100, 100);
-   DrawGridArrow      (x + 651, y + 196, 110, 100);
-   DrawGridSymbol     (x + 776, y + 196,  60, 100);
-   DrawSolarInfo      (x +  10, y + 316, 912, 168);
+   if (widgets & (1UL << WIDGET_PV_INFO)) {
+      DrawBatteryInfo    (x +  10, y +  10, 250, 166);
+   }
+   if (widgets & (1UL << WIDGET_SOLAR)) {
+      DrawSolarSymbol    (x + 276, y +  30, 150, 150);
+      DrawSolarArrow     (x + 346, y + 140,  50,  50);
+   }
+   if (widgets & (1UL << WIDGET_GRID_INFO)) {
+      DrawGridInfo       (x + 436, y +  10, 486, 166);
+   }
+   if (widgets & (1UL << WIDGET_BOILER)) {
+      DrawBatterySymbol  (x +  96, y + 196,  60, 100);
+      DrawBatteryArrow   (x + 171, y + 196, 110, 100);
+   }
+   if (widgets & (1UL << WIDGET_INVERTER)) {
+      DrawInverterArrow  (x + 411, y + 196, 110, 100);
+   }
+   if (widgets & (1UL << WIDGET_GRID)) {
+      DrawGridArrow      (x + 651, y + 196, 110, 100);
+   }
+   if (widgets == WIDGET_ALL) {
+      DrawInverterSymbol (x + 296, y + 196, 100, 100);
+      DrawHouseSymbol    (x + 536, y + 196, 100, 100);
+      DrawGridSymbol     (x + 776, y + 196,  60, 100);
+   }
+   if (widgets & (1UL << WIDGET_CONSUMPTION)) {
+      DrawSolarInfo      (x +  10, y + 316, 912, 168);
+   }
 }
 
-/* Fill the screen. */
-void SolarDisplay::Show()
+/* Refresh only the widget areas of the panel, the canvas is already drawn. */
+void SolarDisplay::UpdateWidgets(uint32_t widgets)
+{
+   M5.EPD.WritePartGram4bpp(0, 0, maxX, maxY, (uint8_t *) canvas.frameBuffer());
+   for (int widget = 0; widget < WIDGET_COUNT; widget++) {
+      if (widgets & (1UL << widget)) {
+         const WidgetArea &area = widgetArea[widget];
+         int               x0   = area.x & ~3; // the controller updates 4 pixel aligned areas
+         int               x1   = (area.x + area.dx + 3) & ~3;
+
+         M5.EPD.UpdateArea(x0, area.y, x1 - x0, area.dy, UPDATE_MODE_GL16);
+      }
+   }
+}
+
+/* Remember what the panel shows for the next partial refresh. */
+void SolarDisplay::SaveState(bool dashboard, bool fullRefresh)
+{
+   DisplayState state;
+
+   if (!LoadNVSRecord(DISPLAY_RECORD_KEY, DISPLAY_RECORD_VERSION, &state, sizeof(state))) {
+      state.lastFullRefresh = 0;
+   }
+   state.dashboard = dashboard;
+   if (fullRefresh) {
+      state.lastFullRefresh = GetRTCTime();
+   }
+   SaveNVSRecord(DISPLAY_RECORD_KEY, DISPLAY_RECORD_VERSION, &state, sizeof(state));
+}
+
+/* Remember the values of the redrawn widgets for the significance check. */
+void SolarDisplay::SaveShown(uint32_t widgets)
+{
+   ShownRecord shown;
+   uint32_t    fields = 0;
+
+   if (widgets == WIDGET_ALL || !LoadNVSRecord(SHOWN_RECORD_KEY, SHOWN_RECORD_VERSION, &shown, sizeof(shown))) {
+      memset(&shown, 0, sizeof(shown));
+   }
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (pvFieldWidget[field] < WIDGET_COUNT && (widgets & (1UL << pvFieldWidget[field]))) {
+         fields |= 1UL << field;
+      }
+   }
+   UpdateShown(shown, myData.huawei, myData.weather, fields, widgets & (1UL << WIDGET_CONSUMPTION), GetRTCTime());
+   SaveNVSRecord(SHOWN_RECORD_KEY, SHOWN_RECORD_VERSION, &shown, sizeof(shown));
+}
+
+/* 
+ * The widgets with a significant change against the panel, see RefreshPolicy.h.
+ * All widgets are dirty if the panel does not show the dashboard or is
+ * due for a full refresh to remove the ghosting of the partial updates.
+ * 0 if no value crossed its threshold, the panel keeps its image.
+ */
+uint32_t SolarDisplay::DirtyWidgets()
+{
+   DisplayState state;
+   ShownRecord  shown;
+   time_t       now     = GetRTCTime();
+   uint32_t     widgets = 0;
+
+   if (!LoadNVSRecord(DISPLAY_RECORD_KEY, DISPLAY_RECORD_VERSION, &state, sizeof(state)) ||
+       !state.dashboard || now - (time_t) state.lastFullRefresh >= FULL_REFRESH_INTERVAL ||
+       !LoadNVSRecord(SHOWN_RECORD_KEY, SHOWN_RECORD_VERSION, &shown, sizeof(shown))) {
+      return WIDGET_ALL;
+   }
+   uint32_t fields = SignificantPVFields(shown, myData.huawei, now);
+
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if ((fields & (1UL << field)) && pvFieldWidget[field] < WIDGET_COUNT) {
+         widgets |= 1UL << pvFieldWidget[field];
+      }
+   }
+   if (SignificantWeatherFields(shown, myData.weather, now)) {
+      widgets |= 1UL << WIDGET_CONSUMPTION;
+   }
+   if (widgets || myData.staleSince) {
+      widgets |= 1UL << WIDGET_HEAD;
+   }
+   return widgets;
+}
+
+/* Fill the screen and refresh the widgets (all widgets with a full GC16 refresh). */
+void SolarDisplay::Show(uint32_t widgets /* = WIDGET_ALL */)
 {
    Serial.println("SolarDisplay::DrawSolarInfo");
 
@@ -491,10 +687,18 @@ void SolarDisplay::Show()
    canvas.setTextDatum(TL_DATUM);
    canvas.createCanvas(maxX, maxY);
 
-   DrawHead(14,  0, maxX - 28, 33);
-   DrawBody(14, 34, maxX - 28, maxY - 45);
+   if (widgets & (1UL << WIDGET_HEAD)) {
+      DrawHead(14,  0, maxX - 28, 33);
+   }
+   DrawBody(14, 34, maxX - 28, maxY - 45, widgets);
 
-   canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+   if (widgets == WIDGET_ALL) {
+      canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+   } else {
+      UpdateWidgets(widgets);
+   }
+   SaveState(true, widgets == WIDGET_ALL);
+   SaveShown(widgets);
    delay(2000);
 }
 
@@ -512,4 +716,5 @@ void SolarDisplay::ShowWiFiError(String ssid)
    canvas.drawCentreString(errMsg, maxX / 2, maxY / 2, 1);
 
    canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+   SaveState(false, true);
 }
@@ -53,3 +53,39 @@ void ShutdownEPD(int sec)
 */   
    M5.shutdown(sec);
 }
+
+/* 
+ *  Deep sleep with the main power held, the RTC slow memory survives 
+ *  and the next wake is a warm wake (see WarmWake.h).
+*/
+void SleepEPD(int sec)
+{
+   Serial.println("Deep sleep");
+   M5.disableEPDPower();
+   M5.disableEXTPower();
+   gpio_hold_en((gpio_num_t) M5EPD_MAIN_PWR_PIN);
+   gpio_deep_sleep_hold_en();
+   esp_sleep_enable_timer_wakeup((uint64_t) sec * 1000000);
+   esp_deep_sleep_start();
+}
+
+/* 
+ *  Shutdown the M5Paper until the RTC time (local time, minute resolution).
+ *  Used for sleeps longer than the 255 minutes of the RTC countdown timer.
+*/
+void ShutdownEPDUntil(time_t wakeTime)
+{
+   rtc_date_t date;
+   rtc_time_t time;
+
+   date.week = -1; // no weekday match, the alarm fires on the date
+   date.year = year(wakeTime);
+   date.mon  = month(wakeTime);
+   date.day  = day(wakeTime);
+   time.hour = hour(wakeTime);
+   time.min  = minute(wakeTime);
+   time.sec  = 0;
+
+   Serial.println("Shutdown until " + getDateTimeString(wakeTime));
+   M5.shutdown(date, time);
+}
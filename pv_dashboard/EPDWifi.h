@@ -21,8 +21,10 @@
   */
 #pragma once
 #include <WiFi.h>
+#include "WakeBudget.h"
+#include "WarmWake.h"
 
-/* Start and connect to the wifi */
+/* Start and connect to the wifi within the PHASE_WIFI budget, a warm wake tries the known access point first */
 bool StartWiFi(int &rssi) 
 {
    IPAddress dns(8, 8, 8, 8); // Google DNS
@@ -36,9 +38,23 @@ bool StartWiFi(int &rssi)
    Serial.println(WIFI_SSID);
    delay(100);
    
-   WiFi.begin(WIFI_SSID, WIFI_PW);
+   if (warmWake && warmState.channel) {
+      unsigned long start = millis();
 
-   for (int retry = 0; WiFi.status() != WL_CONNECTED && retry < 30; retry++) {
+      WiFi.begin(WIFI_SSID, WIFI_PW, warmState.channel, warmState.bssid);
+      while (WiFi.status() != WL_CONNECTED && !wakeBudget.Expired() && millis() - start < WARM_WIFI_TIMEOUT) {
+         delay(50);
+      }
+      if (WiFi.status() != WL_CONNECTED) {
+         Serial.println("Known access point not reachable, scanning");
+         WiFi.disconnect();
+         warmState.channel = 0;
+      }
+   }
+   if (WiFi.status() != WL_CONNECTED) {
+      WiFi.begin(WIFI_SSID, WIFI_PW);
+   }
+   while (WiFi.status() != WL_CONNECTED && !wakeBudget.Expired()) {
       delay(500);
       Serial.print(".");
    }
@@ -46,6 +62,10 @@ bool StartWiFi(int &rssi)
    rssi = 0;
    if (WiFi.status() == WL_CONNECTED) {
       rssi = WiFi.RSSI();
+      if (WiFi.BSSID()) {
+         warmState.channel = WiFi.channel();
+         memcpy(warmState.bssid, WiFi.BSSID(), sizeof(warmState.bssid));
+      }
       Serial.println("WiFi connected at: " + WiFi.localIP().toString());
       return true;
    } else {
@@ -0,0 +1,102 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file EnergyData.h
+  * 
+  * Persistent energy statistics of the wakes.
+  */
+#pragma once
+#include "NVSRecord.h"
+#include "EnergyStats.h"
+
+#define ENERGY_RECORD_VERSION 2
+
+/**
+  * EnergyData: The persistent EnergyRecord (see EnergyStats.h). Every wake 
+  * loads it, adds its sample and saves it again. The state is constant in
+  * size, the energies of today, yesterday and the totals are read from the
+  * accumulators.
+  */
+class EnergyData
+{
+protected:
+   const char   *key_;    //!< NVS key of the record
+   EnergyRecord  record_; //!< The accumulators
+
+public:
+   EnergyData(const char *key)
+      : key_(key)
+   {
+      clear();
+   }
+
+   void clear()
+   {
+      memset(&record_, 0, sizeof(record_));
+   }
+
+   /* Read the record from the NVS, an empty record if there is none. */
+   bool Load()
+   {
+      if (!LoadNVSRecord(key_, ENERGY_RECORD_VERSION, &record_, sizeof(record_))) {
+         clear();
+         return false;
+      }
+      return true;
+   }
+
+   /* Write the record to the NVS. */
+   bool Save()
+   {
+      return SaveNVSRecord(key_, ENERGY_RECORD_VERSION, &record_, sizeof(record_));
+   }
+
+   /* Integrate the powers in W up to this sample, the counters in kWh fill the gaps. */
+   void Add(time_t time, float panel, float grid, float boiler, float meterKWh, float yieldKWh)
+   {
+      EnergySample sample;
+
+      if (record_.last.time && time < record_.last.time) {
+         record_.last.time = 0; // the clock went backwards, restart the integration
+      }
+      sample.time   = time;
+      sample.panel  = panel;
+      sample.grid   = grid;
+      sample.boiler = boiler;
+      sample.meterKWh = meterKWh;
+      sample.yieldKWh = yieldKWh;
+      EnergyAdd(record_, sample);
+   }
+
+   const EnergyDay &Today()     { return record_.today; }
+   const EnergyDay &Yesterday() { return record_.yesterday; }
+   double TotalProducedWh()     { return record_.producedWh; }
+   double TotalSelfWh()         { return record_.selfWh; }
+
+   /* Print today's statistics. */
+   void Dump()
+   {
+      const EnergyDay &today = record_.today;
+
+      Serial.printf("Energy: PV %.0f Wh, import %.0f Wh, export %.0f Wh, boiler %.0f Wh, "
+                    "self consumption %.0f%%, autarky %.0f%%, filled %u s, gap %u s\n",
+         today.producedWh, today.importWh, today.exportWh, today.boilerWh,
+         EnergySelfConsumption(today) * 100, EnergyAutarky(today) * 100, today.filled, today.gap);
+      Serial.printf("Energy: peak PV %.0f W, import %.0f W, export %.0f W\n",
+         today.peakPanel, today.peakImport, today.peakExport);
+   }
+};
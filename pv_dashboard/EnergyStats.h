@@ -0,0 +1,278 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file EnergyStats.h
+  * 
+  * Energy and self consumption statistics integrated from the power samples
+  * of the wakes.
+  *
+  * Every sample integrates the interval to the previous one with the
+  * trapezoidal rule into running accumulators, nothing is ever re-scanned.
+  * The grid power is positive for the export, a sign change inside an 
+  * interval is split at the linear zero crossing. An interval over 
+  * midnight is split at midnight.
+  *
+  * Intervals longer than ENERGY_MAX_GAP (the night, the offline backoff)
+  * are filled from the cumulative meter counters instead: the import from 
+  * the grid meter reading, the production from the daily yield of the 
+  * inverter. The export is the trapezoid of the grid power, limited to 
+  * the production, the boiler energy the trapezoid of its power. Without 
+  * valid counters the interval is counted as gap.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ENERGY_MAX_GAP (30 * 60)      // seconds, a longer interval is a gap
+#define ENERGY_DAY     (24 * 60 * 60) // seconds of a day
+
+/**
+  * Power values of one wake in W and the meter counters in kWh.
+  */
+struct EnergySample
+{
+   uint32_t time;     //!< Local time in seconds since 1970, 0 for none
+   float    panel;    //!< PV power
+   float    grid;     //!< Grid power, > 0 export, < 0 import
+   float    boiler;   //!< Boiler power
+   float    meterKWh; //!< Grid import meter reading, 0 for unknown
+   float    yieldKWh; //!< PV yield of the day
+};
+
+/**
+  * Accumulators of one day.
+  */
+struct EnergyDay
+{
+   uint32_t day;           //!< Days since 1970, 0 for an unused day
+   float    producedWh;    //!< PV energy
+   float    importWh;      //!< Energy from the grid
+   float    exportWh;      //!< Energy into the grid
+   float    boilerWh;      //!< Boiler energy
+   float    selfWh;        //!< PV energy used in the house
+   uint32_t covered;       //!< Integrated seconds
+   uint32_t filled;        //!< Seconds filled from the meter counters
+   uint32_t gap;           //!< Seconds without any energy
+   float    peakPanel;     //!< Largest PV power
+   uint32_t peakPanelTime; //!< Time of peakPanel
+   float    peakImport;    //!< Largest import power
+   float    peakExport;    //!< Largest export power
+};
+
+/**
+  * The persistent state: the last sample, two days and the totals.
+  */
+struct EnergyRecord
+{
+   EnergySample last;       //!< Previous sample
+   EnergyDay    today;      //!< Day of the last sample
+   EnergyDay    yesterday;  //!< Day before, day 0 if there was no sample
+   double       producedWh; //!< Totals since the first sample
+   double       importWh;
+   double       exportWh;
+   double       boilerWh;
+   double       selfWh;
+};
+
+/* Positive value or 0. */
+static inline float EnergyPositive(float value)
+{
+   return value > 0 ? value : 0;
+}
+
+/* PV power used in the house: the PV power without the export. */
+static inline float EnergySelf(const EnergySample &sample)
+{
+   float self = EnergyPositive(sample.panel) - EnergyPositive(sample.grid);
+
+   return self < 0 ? 0 : self;
+}
+
+/* Trapezoid area in Ws of a linear power, split into the positive and the negative part. */
+void EnergyArea(float p0, float p1, float seconds, float &positive, float &negative)
+{
+   positive = 0;
+   negative = 0;
+   if (p0 >= 0 && p1 >= 0) {
+      positive = (p0 + p1) / 2 * seconds;
+   } else if (p0 <= 0 && p1 <= 0) {
+      negative = -(p0 + p1) / 2 * seconds;
+   } else {
+      float crossing = p0 / (p0 - p1) * seconds; // seconds until the zero crossing
+
+      if (p0 > 0) {
+         positive =  p0 / 2 * crossing;
+         negative = -p1 / 2 * (seconds - crossing);
+      } else {
+         negative = -p0 / 2 * crossing;
+         positive =  p1 / 2 * (seconds - crossing);
+      }
+   }
+}
+
+/* Sample at time on the line from a to b. */
+EnergySample EnergyInterpolate(const EnergySample &a, const EnergySample &b, uint32_t time)
+{
+   EnergySample sample;
+   float        f = (float) (time - a.time) / (b.time - a.time);
+
+   sample.time   = time;
+   sample.panel  = a.panel  + (b.panel  - a.panel)  * f;
+   sample.grid   = a.grid   + (b.grid   - a.grid)   * f;
+   sample.boiler = a.boiler + (b.boiler - a.boiler) * f;
+   sample.meterKWh = a.meterKWh + (b.meterKWh - a.meterKWh) * f;
+   sample.yieldKWh = 0; // only used at midnight, the daily yield restarts
+   return sample;
+}
+
+/* Start the day of time, today becomes yesterday if it is the day before. */
+void EnergyRollDay(EnergyRecord &record, uint32_t time)
+{
+   uint32_t day = time / ENERGY_DAY;
+
+   if (record.today.day == day) {
+      return;
+   }
+   if (record.today.day && record.today.day + 1 == day) {
+      record.yesterday = record.today;
+   } else {
+      memset(&record.yesterday, 0, sizeof(record.yesterday));
+   }
+   memset(&record.today, 0, sizeof(record.today));
+   record.today.day = day;
+}
+
+/* Add energies in Wh to today and to the totals. */
+void EnergyAccumulate(EnergyRecord &record, float produced, float imported, float exported, float boiler, float self)
+{
+   EnergyDay &today = record.today;
+
+   today.producedWh  += produced;
+   today.importWh    += imported;
+   today.exportWh    += exported;
+   today.boilerWh    += boiler;
+   today.selfWh      += self;
+   record.producedWh += produced;
+   record.importWh   += imported;
+   record.exportWh   += exported;
+   record.boilerWh   += boiler;
+   record.selfWh     += self;
+}
+
+/* Integrate the interval from a to b inside the current day. */
+void EnergyIntegrate(EnergyRecord &record, const EnergySample &a, const EnergySample &b)
+{
+   float seconds = b.time - a.time;
+   float exported, imported;
+
+   EnergyArea(a.grid, b.grid, seconds, exported, imported);
+
+   float produced = (EnergyPositive(a.panel)  + EnergyPositive(b.panel))  / 2 * seconds / 3600;
+   float boiler   = (EnergyPositive(a.boiler) + EnergyPositive(b.boiler)) / 2 * seconds / 3600;
+   float self     = (EnergySelf(a) + EnergySelf(b)) / 2 * seconds / 3600;
+
+   EnergyAccumulate(record, produced, imported / 3600, exported / 3600, boiler, self);
+   record.today.covered += b.time - a.time;
+}
+
+/* 
+ * Fill the gap from a to b from the meter counters, day by day. The import
+ * is shared by the time, the daily yield counts for the day of b only 
+ * (a gap over midnight is the night without production).
+ */
+void EnergyFillGap(EnergyRecord &record, const EnergySample &a, const EnergySample &b)
+{
+   float    total    = b.time - a.time;
+   float    imported = a.meterKWh > 0 && b.meterKWh >= a.meterKWh ? (b.meterKWh - a.meterKWh) * 1000 : -1;
+   bool     sameDay  = a.time / ENERGY_DAY == b.time / ENERGY_DAY;
+   float    yielded  = (sameDay ? b.yieldKWh - a.yieldKWh : b.yieldKWh) * 1000;
+   float    exportArea, importArea;
+
+   EnergyArea(a.grid, b.grid, total, exportArea, importArea);
+   for (uint32_t time = a.time; time < b.time; ) {
+      uint32_t end = (time / ENERGY_DAY + 1) * ENERGY_DAY;
+
+      if (end > b.time) {
+         end = b.time;
+      }
+      uint32_t seconds = end - time;
+      float    share   = seconds / total;
+
+      EnergyRollDay(record, time);
+      if (imported < 0) {
+         record.today.gap += seconds;
+      } else {
+         float produced = end == b.time ? EnergyPositive(yielded) : 0;
+         float exported = exportArea / 3600 * share;
+         float boiler   = (EnergyPositive(a.boiler) + EnergyPositive(b.boiler)) / 2 * seconds / 3600;
+
+         if (exported > produced) {
+            exported = produced;
+         }
+         EnergyAccumulate(record, produced, imported * share, exported, boiler, produced - exported);
+         record.today.filled += seconds;
+      }
+      time = end;
+   }
+}
+
+/* Add a sample: integrate the interval to the last one and update the peaks. */
+void EnergyAdd(EnergyRecord &record, const EnergySample &sample)
+{
+   EnergySample from = record.last;
+
+   if (from.time && sample.time > from.time && sample.time - from.time <= ENERGY_MAX_GAP) {
+      while (from.time / ENERGY_DAY != sample.time / ENERGY_DAY) {
+         EnergySample midnight = EnergyInterpolate(from, sample, (from.time / ENERGY_DAY + 1) * ENERGY_DAY);
+
+         EnergyIntegrate(record, from, midnight);
+         EnergyRollDay(record, midnight.time);
+         from = midnight;
+      }
+      EnergyIntegrate(record, from, sample);
+   } else if (from.time && sample.time > from.time) {
+      EnergyFillGap(record, from, sample);
+   }
+   EnergyRollDay(record, sample.time);
+
+   EnergyDay &today = record.today;
+
+   if (sample.panel > today.peakPanel) {
+      today.peakPanel     = sample.panel;
+      today.peakPanelTime = sample.time;
+   }
+   if (sample.grid > today.peakExport) {
+      today.peakExport = sample.grid;
+   }
+   if (-sample.grid > today.peakImport) {
+      today.peakImport = -sample.grid;
+   }
+   record.last = sample;
+}
+
+/* Share of the PV energy used in the house, 0..1. */
+float EnergySelfConsumption(const EnergyDay &day)
+{
+   return day.producedWh > 0 ? day.selfWh / day.producedWh : 0;
+}
+
+/* Share of the house consumption covered by PV, 0..1. */
+float EnergyAutarky(const EnergyDay &day)
+{
+   return day.selfWh + day.importWh > 0 ? day.selfWh / (day.selfWh + day.importWh) : 0;
+}
@@ -0,0 +1,208 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file HistoryBlock.h
+  * 
+  * Compressed block of a time series (delta-of-delta timestamps, delta values).
+  *
+  * test/history_bench.cpp checks the round trip and measures the rate on the host.
+  *
+  * A block starts with the first sample in its header, every further sample
+  * is appended to the bit stream as
+  *   timestamp: delta-of-delta of the minutes, zigzag coded
+  *              '0'                   dod == 0
+  *              '10'   +  7 bits      |dod| < 64
+  *              '110'  +  9 bits      |dod| < 256
+  *              '1110' + 12 bits      |dod| < 2048
+  *              '1111' + 32 bits      otherwise
+  *   value:     delta to the previous fixed point value, zigzag coded
+  *              '0'                   unchanged
+  *              '10'   +  7 bits      |delta| < 64
+  *              '110'  + 10 bits      |delta| < 512
+  *              '1110' + 13 bits      |delta| < 4096
+  *              '1111' + 17 bits      otherwise
+  * Samples at a steady wake interval with a steady value take 2 bits, a 
+  * typical power sample 1-3 bytes. The header keeps the state of the last
+  * sample, so appending never decodes the block.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HISTORY_BLOCK_BYTES   240
+#define HISTORY_SAMPLE_BITS   (4 + 32 + 4 + 17) // largest encoded sample
+
+/**
+  * One compressed block with the state of its first and last sample.
+  */
+struct HistoryBlock
+{
+   uint32_t firstTime;                 //!< Minutes since 1970 of the first sample
+   uint32_t lastTime;                  //!< Minutes since 1970 of the last sample
+   int32_t  lastDelta;                 //!< Minutes between the last two samples
+   int16_t  firstValue;                //!< Fixed point value of the first sample
+   int16_t  lastValue;                 //!< Fixed point value of the last sample
+   int16_t  min;                       //!< Smallest value of the block
+   int16_t  max;                       //!< Largest value of the block
+   uint16_t count;                     //!< Number of samples, 0 for an unused block
+   uint16_t bits;                      //!< Used bits of data
+   uint8_t  data[HISTORY_BLOCK_BYTES]; //!< Bit stream of the samples after the first
+};
+
+/**
+  * Read position inside a block.
+  */
+struct HistoryCursor
+{
+   const HistoryBlock *block; //!< Block to read
+   uint16_t            index; //!< Index of the next sample
+   uint16_t            bit;   //!< Next bit of data
+   uint32_t            time;  //!< Minutes of the last read sample
+   int32_t             delta; //!< Minutes between the last two read samples
+   int16_t             value; //!< Last read value
+};
+
+/* Append the lowest count bits of value, msb first. */
+void HistoryPutBits(HistoryBlock &block, uint32_t value, int count)
+{
+   for (int i = count - 1; i >= 0; i--) {
+      if (value & (1UL << i)) {
+         block.data[block.bits >> 3] |= 0x80 >> (block.bits & 7);
+      }
+      block.bits++;
+   }
+}
+
+/* Read count bits, msb first. */
+uint32_t HistoryGetBits(HistoryCursor &cursor, int count)
+{
+   uint32_t value = 0;
+
+   for (int i = 0; i < count; i++) {
+      value = (value << 1) | ((cursor.block->data[cursor.bit >> 3] >> (7 - (cursor.bit & 7))) & 1);
+      cursor.bit++;
+   }
+   return value;
+}
+
+/* Zigzag mapping of a signed value to an unsigned one with small magnitudes first. */
+uint32_t HistoryZigzag(int32_t value)
+{
+   return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+int32_t HistoryUnzigzag(uint32_t value)
+{
+   return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+/* Append a zigzag value with the prefix of the smallest fitting bucket. */
+void HistoryPutBucket(HistoryBlock &block, int32_t value, const int *widths)
+{
+   uint32_t zigzag = HistoryZigzag(value);
+
+   if (zigzag == 0) {
+      HistoryPutBits(block, 0, 1);
+      return;
+   }
+   for (int bucket = 0; bucket < 3; bucket++) {
+      if (zigzag < (1UL << widths[bucket])) {
+         HistoryPutBits(block, (0xE >> (2 - bucket)) & ~1, bucket + 2); // '10', '110', '1110'
+         HistoryPutBits(block, zigzag, widths[bucket]);
+         return;
+      }
+   }
+   HistoryPutBits(block, 0xF, 4);
+   HistoryPutBits(block, zigzag, widths[3]);
+}
+
+/* Read a value written by HistoryPutBucket(). */
+int32_t HistoryGetBucket(HistoryCursor &cursor, const int *widths)
+{
+   int bucket = 0;
+
+   while (bucket < 4 && HistoryGetBits(cursor, 1)) {
+      bucket++;
+   }
+   if (bucket == 0) {
+      return 0;
+   }
+   return HistoryUnzigzag(HistoryGetBits(cursor, widths[bucket - 1]));
+}
+
+static const int historyTimeWidths[4]  = { 7, 9, 12, 32 };
+static const int historyValueWidths[4] = { 7, 10, 13, 17 };
+
+/* Start a block with its first sample. */
+void HistoryBlockInit(HistoryBlock &block, uint32_t time, int16_t value)
+{
+   memset(&block, 0, sizeof(block));
+   block.firstTime  = time;
+   block.lastTime   = time;
+   block.firstValue = value;
+   block.lastValue  = value;
+   block.min        = value;
+   block.max        = value;
+   block.count      = 1;
+}
+
+/* Append a sample, false if the block is full. */
+bool HistoryBlockAppend(HistoryBlock &block, uint32_t time, int16_t value)
+{
+   if (block.bits + HISTORY_SAMPLE_BITS > HISTORY_BLOCK_BYTES * 8 || block.count == 0xffff) {
+      return false;
+   }
+   int32_t delta = (int32_t) (time - block.lastTime);
+
+   HistoryPutBucket(block, delta - block.lastDelta, historyTimeWidths);
+   HistoryPutBucket(block, (int32_t) value - block.lastValue, historyValueWidths);
+   block.lastTime  = time;
+   block.lastDelta = delta;
+   block.lastValue = value;
+   block.min       = value < block.min ? value : block.min;
+   block.max       = value > block.max ? value : block.max;
+   block.count++;
+   return true;
+}
+
+/* Start reading a block from its first sample. */
+void HistoryCursorBegin(HistoryCursor &cursor, const HistoryBlock &block)
+{
+   memset(&cursor, 0, sizeof(cursor));
+   cursor.block = &block;
+}
+
+/* Read the next sample, false at the end of the block. */
+bool HistoryCursorNext(HistoryCursor &cursor, uint32_t &time, int16_t &value)
+{
+   if (cursor.index >= cursor.block->count) {
+      return false;
+   }
+   if (cursor.index == 0) {
+      cursor.time  = cursor.block->firstTime;
+      cursor.value = cursor.block->firstValue;
+   } else {
+      cursor.delta += HistoryGetBucket(cursor, historyTimeWidths);
+      cursor.time  += cursor.delta;
+      cursor.value += HistoryGetBucket(cursor, historyValueWidths);
+   }
+   cursor.index++;
+   time  = cursor.time;
+   value = cursor.value;
+   return true;
+}
@@ -0,0 +1,147 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file HistoryData.h
+  * 
+  * Persistent ring of compressed blocks for the intraday curves.
+  */
+#pragma once
+#include "NVSRecord.h"
+#include "HistoryRing.h"
+
+#define HISTORY_RECORD_VERSION 3
+
+/**
+  * HistoryData: A fixed capacity series of values with their time.
+  * The values are stored as value * scale_ in a HistoryRing (see 
+  * HistoryRing.h), min and max come from the block headers. The ring is
+  * a record of NVSRecord.h, too large for the RTC copies of the warm wakes.
+  */
+class HistoryData : public HistoryRing
+{
+public:
+   String         unitName_; //!< Unit Name of the values
+
+protected:
+   const char    *key_;      //!< NVS key of the ring
+   float          scale_;    //!< value * scale_ is stored
+
+   friend class HistoryReader;
+
+public:
+   HistoryData(const char *key, int blocks, float scale, String unitName)
+      : HistoryRing(blocks)
+      , unitName_(unitName)
+      , key_(key)
+      , scale_(scale)
+   {
+   }
+
+   /* Read the ring from the NVS, an empty ring if there is none. */
+   bool Load()
+   {
+      if (!LoadNVSRecord(key_, HISTORY_RECORD_VERSION, ring_, RingSize())) {
+         clear();
+         return false;
+      }
+      return true;
+   }
+
+   /* Write the ring to the NVS. */
+   bool Save()
+   {
+      return SaveNVSRecord(key_, HISTORY_RECORD_VERSION, ring_, RingSize());
+   }
+
+   /* Append a value, the oldest block is dropped if the ring is full. */
+   void Append(time_t time, float value)
+   {
+      long fixed = lround(value * scale_);
+
+      AppendSample(time, constrain(fixed, (long) INT16_MIN, (long) INT16_MAX));
+   }
+
+   /* Average of a query point. */
+   float PointAvg(const HistoryPoint &point)
+   {
+      return point.count ? point.sum / (float) point.count / scale_ : 0.0;
+   }
+
+   /* Smallest value of a query point. */
+   float PointMin(const HistoryPoint &point)
+   {
+      return point.min / scale_;
+   }
+
+   /* Largest value of a query point. */
+   float PointMax(const HistoryPoint &point)
+   {
+      return point.max / scale_;
+   }
+
+   /* Smallest stored value, 0 for an empty ring. */
+   float Min()
+   {
+      return header_->used ? MinSample() / scale_ : 0.0;
+   }
+
+   /* Largest stored value, 0 for an empty ring. */
+   float Max()
+   {
+      return header_->used ? MaxSample() / scale_ : 0.0;
+   }
+};
+
+/**
+  * Streaming pass over all samples of a HistoryData, oldest first.
+  */
+class HistoryReader
+{
+protected:
+   HistoryData  &history_; //!< Series to read
+   int           block_;   //!< Index of the current block (oldest = 0)
+   HistoryCursor cursor_;  //!< Position inside the current block
+
+public:
+   HistoryReader(HistoryData &history)
+      : history_(history)
+      , block_(0)
+   {
+      if (history_.Blocks()) {
+         HistoryCursorBegin(cursor_, history_.Block(0));
+      }
+   }
+
+   /* Read the next sample, false after the newest one. */
+   bool Next(time_t &time, float &value)
+   {
+      uint32_t minutes;
+      int16_t  sample;
+
+      while (block_ < history_.Blocks()) {
+         if (HistoryCursorNext(cursor_, minutes, sample)) {
+            time  = (time_t) minutes * 60;
+            value = sample / history_.scale_;
+            return true;
+         }
+         if (++block_ < history_.Blocks()) {
+            HistoryCursorBegin(cursor_, history_.Block(block_));
+         }
+      }
+      return false;
+   }
+};
@@ -0,0 +1,203 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file HistoryRing.h
+  * 
+  * Ring of compressed blocks with the hourly and daily tier of a series.
+  */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "HistoryBlock.h"
+#include "HistoryRollup.h"
+
+/**
+  * Ring state, stored in front of the rollup and the blocks.
+  */
+struct HistoryHeader
+{
+   uint16_t head; //!< Index of the block which takes the next sample
+   uint16_t used; //!< Number of used blocks
+};
+
+/**
+  * HistoryRing: The int16 fixed point samples of a series in size_
+  * HistoryBlocks (see HistoryBlock.h) and the tiers of HistoryRollup.h.
+  * Append is O(1) and only touches the newest block, when it is full the
+  * oldest block is dropped. The header, the rollup and the blocks are one
+  * buffer which HistoryData.h stores as a record.
+  */
+class HistoryRing
+{
+public:
+   int            size_;     //!< Number of blocks.
+
+protected:
+   uint8_t       *ring_;     //!< HistoryHeader, HistoryRollup and size_ blocks
+   HistoryHeader *header_;   //!< Ring state inside ring_
+   HistoryRollup *rollup_;   //!< Hourly and daily tier inside ring_
+   HistoryBlock  *blocks_;   //!< Blocks inside ring_
+
+protected:
+   /* Size of the stored ring. */
+   size_t RingSize()
+   {
+      return sizeof(HistoryHeader) + sizeof(HistoryRollup) + size_ * sizeof(HistoryBlock);
+   }
+
+public:
+   HistoryRing(int blocks)
+      : size_(blocks)
+   {
+      ring_    = (uint8_t *) malloc(RingSize());
+      header_  = (HistoryHeader *) ring_;
+      rollup_  = (HistoryRollup *) (ring_ + sizeof(HistoryHeader));
+      blocks_  = (HistoryBlock *) (ring_ + sizeof(HistoryHeader) + sizeof(HistoryRollup));
+      clear();
+   }
+
+   ~HistoryRing()
+   {
+      free(ring_);
+   }
+
+   void clear()
+   {
+      memset(ring_, 0, RingSize());
+   }
+
+   /* Append a fixed point sample, the oldest block is dropped if the ring is full. */
+   void AppendSample(time_t time, int16_t sample)
+   {
+      uint32_t minutes = time / 60;
+
+      if (header_->used && minutes < blocks_[header_->head].lastTime) {
+         memset(header_, 0, sizeof(*header_)); // the clock went backwards, the tiers keep their buckets
+      }
+      HistoryRollupAdd(*rollup_, minutes, sample);
+      if (header_->used && HistoryBlockAppend(blocks_[header_->head], minutes, sample)) {
+         return;
+      }
+      if (header_->used) {
+         header_->head = (header_->head + 1) % size_;
+      }
+      if (header_->used < size_) {
+         header_->used++;
+      }
+      HistoryBlockInit(blocks_[header_->head], minutes, sample);
+   }
+
+   /* 
+    * Aggregate the range into count graph points. The coarsest tier with
+    * buckets not larger than one point answers the query, only a range
+    * finer than an hour per point reads the raw samples. The bucket in 
+    * which an unaligned from falls is added to the first point. Points 
+    * without samples (older than the tier) have count 0.
+    */
+   void Query(time_t from, time_t to, int count, HistoryPoint *points)
+   {
+      if (count <= 0) {
+         return;
+      }
+      uint32_t start = from / 60;
+      uint32_t step  = (to - from) / 60 / count;
+
+      if (step < 1) {
+         step = 1;
+      }
+      HistoryPointsInit(points, count, start, step);
+      if (step >= HISTORY_DAY) {
+         HistoryTierQuery(rollup_->days, HISTORY_DAYS, rollup_->dayState, HISTORY_DAY, start, step, points, count);
+      } else if (step >= HISTORY_HOUR) {
+         HistoryTierQuery(rollup_->hours, HISTORY_HOURS, rollup_->hourState, HISTORY_HOUR, start, step, points, count);
+      } else {
+         for (int i = 0; i < header_->used; i++) {
+            HistoryCursor cursor;
+            uint32_t      minutes;
+            int16_t       sample;
+
+            if (Block(i).lastTime < start) {
+               continue;
+            }
+            HistoryCursorBegin(cursor, Block(i));
+            while (HistoryCursorNext(cursor, minutes, sample) && minutes < start + step * count) {
+               if (minutes >= start) {
+                  HistoryPointMerge(points[(minutes - start) / step], sample, sample, sample, 1);
+               }
+            }
+         }
+      }
+   }
+
+   /* Number of used blocks. */
+   int Blocks()
+   {
+      return header_->used;
+   }
+
+   /* The i-th oldest used block. */
+   const HistoryBlock &Block(int i)
+   {
+      return blocks_[(header_->head + size_ - header_->used + 1 + i) % size_];
+   }
+
+   /* Number of stored samples. */
+   int Count()
+   {
+      int count = 0;
+
+      for (int i = 0; i < header_->used; i++) {
+         count += Block(i).count;
+      }
+      return count;
+   }
+
+   /* Smallest stored sample, INT16_MAX for an empty ring. */
+   int16_t MinSample()
+   {
+      int16_t sample = INT16_MAX;
+
+      for (int i = 0; i < header_->used; i++) {
+         sample = Block(i).min < sample ? Block(i).min : sample;
+      }
+      return sample;
+   }
+
+   /* Largest stored sample, INT16_MIN for an empty ring. */
+   int16_t MaxSample()
+   {
+      int16_t sample = INT16_MIN;
+
+      for (int i = 0; i < header_->used; i++) {
+         sample = Block(i).max > sample ? Block(i).max : sample;
+      }
+      return sample;
+   }
+
+   /* Bytes of the compressed samples. */
+   size_t UsedBytes()
+   {
+      size_t bytes = 0;
+
+      for (int i = 0; i < header_->used; i++) {
+         bytes += sizeof(HistoryBlock) - HISTORY_BLOCK_BYTES + (Block(i).bits + 7) / 8;
+      }
+      return bytes;
+   }
+};
@@ -0,0 +1,157 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file HistoryRollup.h
+  * 
+  * Hourly and daily aggregates of a time series, updated on every sample.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HISTORY_HOURS  48 // hourly buckets, two days
+#define HISTORY_DAYS   32 // daily buckets, one month
+
+#define HISTORY_HOUR   60        // minutes of an hourly bucket
+#define HISTORY_DAY    (24 * 60) // minutes of a daily bucket
+
+/**
+  * Aggregate of the fixed point samples in one time slot.
+  */
+struct HistoryBucket
+{
+   uint32_t start; //!< Minutes since 1970 of the slot start
+   int32_t  sum;   //!< Sum of the samples
+   int16_t  min;   //!< Smallest sample
+   int16_t  max;   //!< Largest sample
+   uint16_t count; //!< Number of samples, 0 for an unused bucket
+   uint16_t spare; //!< Padding
+};
+
+/**
+  * Position of a bucket ring inside HistoryRollup.
+  */
+struct HistoryTierState
+{
+   uint16_t head; //!< Index of the newest bucket
+   uint16_t used; //!< Number of used buckets
+};
+
+/**
+  * The hourly and daily tier of one series.
+  */
+struct HistoryRollup
+{
+   HistoryTierState hourState;           //!< Ring state of hours
+   HistoryTierState dayState;            //!< Ring state of days
+   HistoryBucket    hours[HISTORY_HOURS]; //!< Hourly tier
+   HistoryBucket    days[HISTORY_DAYS];   //!< Daily tier
+};
+
+/**
+  * One point of a graph query, aggregated over its time span.
+  */
+struct HistoryPoint
+{
+   uint32_t start; //!< Minutes since 1970 of the point start
+   int16_t  min;   //!< Smallest sample
+   int16_t  max;   //!< Largest sample
+   int32_t  sum;   //!< Sum of the samples
+   uint16_t count; //!< Number of samples, 0 for a gap
+};
+
+/* Add a sample to the bucket ring, a new slot starts a new bucket and evicts the oldest. */
+void HistoryTierAdd(HistoryBucket *buckets, int size, HistoryTierState &state, uint32_t start, int16_t value)
+{
+   HistoryBucket *bucket = state.used ? &buckets[state.head] : NULL;
+
+   if (!bucket || bucket->start != start) {
+      if (state.used) {
+         state.head = (state.head + 1) % size;
+      }
+      if (state.used < size) {
+         state.used++;
+      }
+      bucket = &buckets[state.head];
+      memset(bucket, 0, sizeof(*bucket));
+      bucket->start = start;
+      bucket->min   = value;
+      bucket->max   = value;
+   }
+   bucket->sum += value;
+   bucket->min  = value < bucket->min ? value : bucket->min;
+   bucket->max  = value > bucket->max ? value : bucket->max;
+   bucket->count++;
+}
+
+/* The i-th oldest bucket of a ring. */
+const HistoryBucket &HistoryTierBucket(const HistoryBucket *buckets, int size, const HistoryTierState &state, int i)
+{
+   return buckets[(state.head + size - state.used + 1 + i) % size];
+}
+
+/* Add a sample to all tiers. */
+void HistoryRollupAdd(HistoryRollup &rollup, uint32_t time, int16_t value)
+{
+   HistoryTierAdd(rollup.hours, HISTORY_HOURS, rollup.hourState, time - time % HISTORY_HOUR, value);
+   HistoryTierAdd(rollup.days,  HISTORY_DAYS,  rollup.dayState,  time - time % HISTORY_DAY,  value);
+}
+
+/* Merge an aggregate into a graph point. */
+void HistoryPointMerge(HistoryPoint &point, int32_t sum, int16_t min, int16_t max, uint16_t count)
+{
+   if (point.count == 0) {
+      point.min = min;
+      point.max = max;
+   }
+   point.sum   += sum;
+   point.min    = min < point.min ? min : point.min;
+   point.max    = max > point.max ? max : point.max;
+   point.count += count;
+}
+
+/* Clear the graph points for count spans of step minutes from the start. */
+void HistoryPointsInit(HistoryPoint *points, int count, uint32_t from, uint32_t step)
+{
+   memset(points, 0, count * sizeof(HistoryPoint));
+   for (int i = 0; i < count; i++) {
+      points[i].start = from + i * step;
+   }
+}
+
+/* 
+ * Aggregate a tier with buckets of width minutes into count graph points of
+ * step minutes from the start. A bucket which overlaps the start goes into 
+ * the first point. Returns the number of buckets which fell into the range.
+ */
+int HistoryTierQuery(const HistoryBucket *buckets, int size, const HistoryTierState &state, uint32_t width,
+                     uint32_t from, uint32_t step, HistoryPoint *points, int count)
+{
+   int found = 0;
+
+   for (int i = 0; i < state.used; i++) {
+      const HistoryBucket &bucket = HistoryTierBucket(buckets, size, state, i);
+      uint32_t             start  = bucket.start > from ? bucket.start : from;
+
+      if (bucket.count && bucket.start + width > from && start < from + step * count) {
+         HistoryPointMerge(points[(start - from) / step], bucket.sum, bucket.min, bucket.max, bucket.count);
+         found++;
+      }
+   }
+   return found;
+}
@@ -0,0 +1,302 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file InflateStream.h
+  * 
+  * Stream wrapper which decodes a gzip or deflate http body on the fly.
+  */
+#pragma once
+#include "Crc32.h"
+#include "WakeArena.h"
+#if __has_include("esp32/rom/miniz.h")
+#include "esp32/rom/miniz.h"
+#else
+#include "rom/miniz.h"
+#endif
+
+#define ACCEPT_ENCODING  "gzip, deflate"
+#define INFLATE_IN_SIZE  512
+
+/**
+  * Decodes the Content-Encoding of the source stream with the tinfl decoder 
+  * of the ESP32 ROM. Only the 32 KB deflate window is kept in memory, the 
+  * decompressed body is never materialized. Without a Content-Encoding the
+  * source is passed through.
+  */
+class InflateStream : public Stream
+{
+protected:
+   /**
+     * Working memory of the decoder, allocated only for encoded bodies.
+     */
+   struct Inflater
+   {
+      tinfl_decompressor decomp;                   //!< tinfl decoder state
+      uint8_t            dict[TINFL_LZ_DICT_SIZE]; //!< Wrapping output window
+      uint8_t            in[INFLATE_IN_SIZE];      //!< Compressed input buffer
+   };
+
+   Stream   &source;    //!< The http stream
+   Inflater *inflater;  //!< Decoder memory in the wakeArena or NULL for pass through
+   uint32_t  flags;     //!< tinfl flags (zlib header or raw deflate)
+   size_t    inPos;     //!< Read position in the input buffer
+   size_t    inLen;     //!< Filled size of the input buffer
+   size_t    dictOfs;   //!< Write position in the window
+   size_t    outPos;    //!< Read position in the window
+   size_t    outAvail;  //!< Decoded bytes not yet read
+   bool      sourceEnd; //!< No more compressed input
+   bool      done;      //!< Decoder finished or failed
+   size_t    received;  //!< Compressed bytes read from the source
+   unsigned long deadline; //!< millis() after which the body is cut off, 0 for none
+   uint32_t  hash;      //!< CRC32 of the decoded bytes read so far
+
+protected:
+   /* The deadline of SetDeadline() has passed. */
+   bool Cancelled()
+   {
+      return deadline && (long) (millis() - deadline) >= 0;
+   }
+
+   /* Read the next byte of the source, -1 at the end. */
+   int SourceByte()
+   {
+      if (inPos == inLen && !FillInput()) {
+         return -1;
+      }
+      return inflater->in[inPos++];
+   }
+
+   /* Read the next compressed bytes of the source. */
+   bool FillInput()
+   {
+      if (sourceEnd || Cancelled()) {
+         return false;
+      }
+      size_t want = max(1, min(source.available(), INFLATE_IN_SIZE));
+
+      inPos = 0;
+      inLen = source.readBytes((char *) inflater->in, want);
+      received += inLen;
+      if (inLen == 0) {
+         sourceEnd = true;
+      }
+      return inLen > 0;
+   }
+
+   /* Skip the gzip member header (RFC 1952). */
+   bool SkipGzipHeader()
+   {
+      int header[10];
+
+      for (int i = 0; i < 10; i++) {
+         header[i] = SourceByte();
+      }
+      if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8) {
+         return false;
+      }
+      int flg = header[3];
+
+      if (flg & 0x04) { // FEXTRA
+         int len = SourceByte();
+
+         len |= SourceByte() << 8;
+         while (len-- > 0 && SourceByte() >= 0);
+      }
+      if (flg & 0x08) { // FNAME
+         for (int c = SourceByte(); c > 0; c = SourceByte());
+      }
+      if (flg & 0x10) { // FCOMMENT
+         for (int c = SourceByte(); c > 0; c = SourceByte());
+      }
+      if (flg & 0x02) { // FHCRC
+         SourceByte();
+         SourceByte();
+      }
+      return !sourceEnd;
+   }
+
+   /* Decode until output is available, false at the end of the body. */
+   bool FillOutput()
+   {
+      while (outAvail == 0 && !done) {
+         if (inPos == inLen) {
+            FillInput();
+         }
+         size_t inBytes  = inLen - inPos;
+         size_t outBytes = TINFL_LZ_DICT_SIZE - dictOfs;
+
+         tinfl_status status = tinfl_decompress(&inflater->decomp, 
+                                                inflater->in + inPos, &inBytes,
+                                                inflater->dict, inflater->dict + dictOfs, &outBytes,
+                                                flags | (sourceEnd ? 0 : TINFL_FLAG_HAS_MORE_INPUT));
+         inPos   += inBytes;
+         outPos   = dictOfs;
+         outAvail = outBytes;
+         dictOfs  = (dictOfs + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+         if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_NEEDS_MORE_INPUT && sourceEnd)) {
+            Serial.printf("Inflate failed: %d\n", status);
+            done = true;
+         } else if (status == TINFL_STATUS_DONE) {
+            done = true;
+         }
+      }
+      return outAvail > 0;
+   }
+
+public:
+   InflateStream(Stream &src)
+      : source(src)
+      , inflater(NULL)
+      , flags(0)
+      , inPos(0)
+      , inLen(0)
+      , dictOfs(0)
+      , outPos(0)
+      , outAvail(0)
+      , sourceEnd(false)
+      , done(false)
+      , received(0)
+      , deadline(0)
+      , hash(0)
+   {
+   }
+
+   ~InflateStream()
+   {
+      wakeArena.Free(inflater);
+   }
+
+   /* Select the decoder for the Content-Encoding header value. */
+   bool Begin(const String &encoding)
+   {
+      if (encoding != "gzip" && encoding != "deflate") {
+         return encoding.length() == 0;
+      }
+      inflater = (Inflater *) wakeArena.Alloc(sizeof(Inflater));
+      if (!inflater) {
+         Serial.println("Inflate: out of memory");
+         return false;
+      }
+      tinfl_init(&inflater->decomp);
+      if (encoding == "gzip") {
+         if (!SkipGzipHeader()) {
+            Serial.println("Inflate: invalid gzip header");
+            done = true;
+            return false;
+         }
+      } else {
+         flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+      }
+      return true;
+   }
+
+   /* End the body at the millis() deadline, a cut off document fails to parse. */
+   void SetDeadline(unsigned long ms)
+   {
+      deadline = ms ? ms : 1;
+   }
+
+   /* CRC32 of the decoded body, complete after the parser has read it to the end. */
+   uint32_t Hash()
+   {
+      return hash;
+   }
+
+   /* Bytes read from the source (compressed size for an encoded body). */
+   size_t Received()
+   {
+      return received;
+   }
+
+   int available() override
+   {
+      if (!inflater) {
+         return source.available();
+      }
+      return FillOutput() ? outAvail : 0;
+   }
+
+   int read() override
+   {
+      int c;
+
+      if (!inflater) {
+         if (Cancelled()) {
+            return -1;
+         }
+         c = source.read();
+         received += c >= 0;
+      } else if (!FillOutput()) {
+         return -1;
+      } else {
+         outAvail--;
+         c = inflater->dict[outPos++];
+      }
+      if (c >= 0) {
+         uint8_t b = c;
+
+         hash = Crc32(&b, 1, hash);
+      }
+      return c;
+   }
+
+   int peek() override
+   {
+      if (!inflater) {
+         return source.peek();
+      }
+      return FillOutput() ? inflater->dict[outPos] : -1;
+   }
+
+   /* Read without waiting for the stream timeout at the end of the decoded body. */
+   size_t readBytes(char *buffer, size_t length)
+   {
+      if (!inflater) {
+         if (Cancelled()) {
+            return 0;
+         }
+         size_t count = source.readBytes(buffer, length);
+
+         received += count;
+         hash      = Crc32(buffer, count, hash);
+         return count;
+      }
+      size_t count = 0;
+
+      while (count < length && FillOutput()) {
+         size_t n = min(length - count, outAvail);
+
+         memcpy(buffer + count, inflater->dict + outPos, n);
+         outPos   += n;
+         outAvail -= n;
+         count    += n;
+      }
+      hash = Crc32(buffer, count, hash);
+      return count;
+   }
+
+   size_t readBytes(uint8_t *buffer, size_t length)
+   {
+      return readBytes((char *) buffer, length);
+   }
+
+   size_t write(uint8_t) override
+   {
+      return 0;
+   }
+};
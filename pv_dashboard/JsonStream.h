@@ -0,0 +1,314 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file JsonStream.h
+  * 
+  * Streaming json parser without a document tree and without heap.
+  *
+  * The parser reads the body byte by byte and calls the handler for every
+  * scalar value with the path of member names from the root. The path is 
+  * kept as its FNV-1a hash, so the handler dispatches with a switch over 
+  * JsonHash("current.weather.main") constants, the array indices are 
+  * passed separately. Duplicate case labels make the compiler reject a
+  * collision between the known paths. The values are handed over as text,
+  * JsonFixed() converts a number to fixed point without floating point.
+  */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH 8  // nesting levels of objects and arrays
+#define JSON_MAX_TEXT  32 // longer values are truncated
+#define JSON_HASH_SEED 2166136261UL
+#define JSON_HASH_MUL  16777619UL
+
+/* FNV-1a hash of a path like "hourly.weather.main", continued from hash. */
+constexpr uint32_t JsonHash(const char *path, uint32_t hash = JSON_HASH_SEED)
+{
+   return *path ? JsonHash(path + 1, (uint32_t) ((hash ^ (uint8_t) *path) * JSON_HASH_MUL)) : hash;
+}
+
+#ifndef ARDUINO
+/**
+  * Source of the body off the device, the parser only uses readBytes of the Arduino Stream.
+  */
+class Stream
+{
+public:
+   virtual ~Stream() {}
+
+   /* Read up to length bytes, fewer at the end of the body. */
+   virtual size_t readBytes(char *buffer, size_t length) = 0;
+};
+#endif
+
+/**
+  * Position of a value in the document.
+  */
+struct JsonPath
+{
+   uint32_t hash;                  //!< JsonHash of the member names from the root joined by '.'
+   uint8_t  depth;                 //!< Number of enclosing arrays
+   int16_t  index[JSON_MAX_DEPTH]; //!< Index in every enclosing array, outermost first
+};
+
+/**
+  * Receiver of the scalar values.
+  */
+class JsonHandler
+{
+public:
+   /* A number, string or boolean (as "1" or "0") at path, null values are skipped. */
+   virtual void Value(const JsonPath &path, const char *text, bool isString) = 0;
+};
+
+/**
+  * Recursive descent parser over a Stream, linear in the body size.
+  */
+class JsonParser
+{
+protected:
+   Stream      &source;             //!< The body
+   JsonHandler &handler;            //!< Receiver of the values
+   int          c;                  //!< Current character, -1 at the end
+   JsonPath     path;               //!< Path of the current value
+   uint8_t      nesting;            //!< Open objects and arrays
+   char         text[JSON_MAX_TEXT]; //!< Current scalar
+
+protected:
+   /* Read the next character, waiting up to the stream timeout. */
+   void Next()
+   {
+      char b;
+
+      c = source.readBytes(&b, 1) == 1 ? (uint8_t) b : -1;
+   }
+
+   /* 
+    * Step over the closing character of a value with the given nesting, 
+    * unless it closes the root value: a keep-alive body has no more bytes 
+    * and the read would wait for the stream timeout.
+    */
+   void Close(uint8_t level)
+   {
+      if (nesting > level) {
+         Next();
+      }
+   }
+
+   /* Skip the white space. */
+   void SkipSpace()
+   {
+      while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+         Next();
+      }
+   }
+
+   /* Read a string behind its opening quote into text, extending hash if not NULL. */
+   bool ParseString(uint32_t *hash)
+   {
+      size_t len = 0;
+
+      for (Next(); c != '"'; Next()) {
+         if (c < 0) {
+            return false;
+         }
+         if (c == '\\') {
+            Next();
+            switch (c) {
+               case 'b': c = '\b'; break;
+               case 'f': c = '\f'; break;
+               case 'n': c = '\n'; break;
+               case 'r': c = '\r'; break;
+               case 't': c = '\t'; break;
+               case 'u': for (int i = 0; i < 4; i++) Next(); c = '?'; break;
+               case -1:  return false;
+            }
+         }
+         if (hash) {
+            *hash = (*hash ^ (uint8_t) c) * JSON_HASH_MUL;
+         }
+         if (len < JSON_MAX_TEXT - 1) {
+            text[len++] = c;
+         }
+      }
+      text[len] = 0;
+      Close(0);
+      return true;
+   }
+
+   /* Read a number or a literal into text. */
+   bool ParseLiteral()
+   {
+      size_t len = 0;
+
+      while (c > ' ' && c != ',' && c != '}' && c != ']') {
+         if (len < JSON_MAX_TEXT - 1) {
+            text[len++] = c;
+         }
+         Next();
+      }
+      text[len] = 0;
+      return len > 0;
+   }
+
+   /* Parse any value at the path hash. */
+   bool ParseValue(uint32_t hash)
+   {
+      bool ok;
+
+      SkipSpace();
+      path.hash = hash;
+      switch (c) {
+         case '{': 
+         case '[': 
+            if (nesting >= 2 * JSON_MAX_DEPTH) return false;
+            nesting++;
+            ok = c == '{' ? ParseObject(hash) : ParseArray(hash);
+            nesting--;
+            return ok;
+         case '"': 
+            if (!ParseString(NULL)) return false;
+            handler.Value(path, text, true);
+            return true;
+         default:
+            if (!ParseLiteral()) return false;
+            if (text[0] == 't' || text[0] == 'f') {
+               text[0] = text[0] == 't' ? '1' : '0';
+               text[1] = 0;
+            } else if (text[0] == 'n') {
+               return true;
+            }
+            handler.Value(path, text, false);
+            return true;
+      }
+   }
+
+   /* Parse the members of an object, the member paths continue hash. */
+   bool ParseObject(uint32_t hash)
+   {
+      bool root = hash == JSON_HASH_SEED;
+
+      for (Next(), SkipSpace(); c != '}'; SkipSpace()) {
+         uint32_t member = root ? hash : (uint32_t) ((hash ^ '.') * JSON_HASH_MUL);
+
+         if (c != '"' || !ParseString(&member)) {
+            return false;
+         }
+         SkipSpace();
+         if (c != ':') {
+            return false;
+         }
+         Next();
+         if (!ParseValue(member)) {
+            return false;
+         }
+         SkipSpace();
+         if (c == ',') {
+            Next();
+            SkipSpace();
+         } else if (c != '}') {
+            return false;
+         }
+      }
+      Close(1);
+      return true;
+   }
+
+   /* Parse the elements of an array, they share the path hash. */
+   bool ParseArray(uint32_t hash)
+   {
+      if (path.depth >= JSON_MAX_DEPTH) {
+         return false;
+      }
+      int level = path.depth++;
+
+      path.index[level] = 0;
+      for (Next(), SkipSpace(); c != ']'; SkipSpace()) {
+         if (!ParseValue(hash)) {
+            return false;
+         }
+         SkipSpace();
+         if (c == ',') {
+            Next();
+            path.index[level]++;
+         } else if (c != ']') {
+            return false;
+         }
+      }
+      path.depth--;
+      Close(1);
+      return true;
+   }
+
+public:
+   JsonParser(Stream &src, JsonHandler &target)
+      : source(src)
+      , handler(target)
+      , c(-1)
+      , nesting(0)
+   {
+      memset(&path, 0, sizeof(path));
+   }
+
+   /* Parse one document, stops behind the root value. */
+   bool Parse()
+   {
+      Next();
+      return ParseValue(JSON_HASH_SEED);
+   }
+};
+
+/* 
+ * Fixed point value * scale of a decimal number text like "-12.345e1",
+ * rounded half away from zero and saturated to int32.
+ */
+int32_t JsonFixed(const char *text, int32_t scale)
+{
+   const char *p        = text;
+   bool        negative = *p == '-';
+   int64_t     value    = 0;
+   int         exp10    = 0;
+
+   if (*p == '-' || *p == '+') p++;
+   for (; *p >= '0' && *p <= '9'; p++) {
+      if (value < 100000000000000LL) value = value * 10 + (*p - '0'); else exp10++;
+   }
+   if (*p == '.') {
+      for (p++; *p >= '0' && *p <= '9'; p++) {
+         if (value < 100000000000000LL) { value = value * 10 + (*p - '0'); exp10--; }
+      }
+   }
+   if (*p == 'e' || *p == 'E') {
+      exp10 += atoi(p + 1);
+   }
+   value *= scale;
+   for (; exp10 > 0 && value; exp10--) {
+      value = value < 10000000000LL ? value * 10 : 2147483647LL;
+   }
+   if (exp10 < 0) {
+      for (; exp10 < -1 && value; exp10++) {
+         value /= 10;
+      }
+      value = (value + 5) / 10;
+   }
+   if (value > 2147483647LL) {
+      value = 2147483647LL;
+   }
+   return negative ? (int32_t) -value : (int32_t) value;
+}
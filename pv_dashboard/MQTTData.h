@@ -0,0 +1,87 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file MQTTData.h
+  * 
+  * Alternative PV data source: the retained messages of a MQTT broker.
+  */
+#pragma once
+#include <WiFiClient.h>
+#include <PubSubClient.h>
+#include "getJsonData.h"
+#include "MQTTTopic.h"
+
+static PVValues mqttValues;       //!< Target of the message callback
+static uint32_t mqttReceived = 0; //!< Topics received so far, bit n = mqttTopics[n]
+
+/* Store one retained message into mqttValues. */
+void OnMQTTMessage(char *topic, uint8_t *payload, unsigned int length)
+{
+   mqttReceived |= MQTTMessageToValues(topic, payload, length, mqttValues);
+}
+
+/* 
+ * Read the PV values from the retained messages of the MQTT broker.
+ * One connection: connect, subscribe all topics, wait for the retained
+ * messages (at most MQTT_TIMEOUT ms) and disconnect. Topics without a 
+ * message keep the value of the last cached snapshot.
+ */
+bool GetMQTTValues(MyData &myData)
+{
+   WiFiClient   client;
+   PubSubClient mqtt(client);
+   uint32_t     allTopics = (uint32_t) ((1ULL << MQTT_TOPIC_COUNT) - 1);
+
+   if (!LoadCachedHTTPValues(myData)) {
+      myData.pvChanged = PV_ALL_FIELDS;
+   }
+   PVSnapshot previous;
+
+   myData.huawei.ToSnapshot(previous);
+
+   mqttValues.mask = 0;
+   mqttReceived    = 0;
+   mqtt.setServer(MQTT_SERVER, MQTT_PORT);
+   mqtt.setBufferSize(256);
+   mqtt.setCallback(OnMQTTMessage);
+   mqtt.setSocketTimeout(max(1U, wakeBudget.Remaining() / 1000));
+   if (!mqtt.connect(MQTT_CLIENT, MQTT_USER, MQTT_PW)) {
+      Serial.printf("MQTT connect failed: %d\n", mqtt.state());
+      return false;
+   }
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      mqtt.subscribe(mqttTopics[i].topic);
+   }
+   for (unsigned long start = millis(); mqttReceived != allTopics && millis() - start < MQTT_TIMEOUT && !wakeBudget.Expired(); ) {
+      mqtt.loop();
+      delay(1);
+   }
+   mqtt.disconnect();
+   client.stop();
+   ApplyPVValues(mqttValues, myData.huawei);
+
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      if (!(mqttReceived & (1UL << i))) {
+         Serial.printf("MQTT topic missing: %s\n", mqttTopics[i].topic);
+      }
+   }
+   myData.pvChanged |= myData.huawei.Diff(previous);
+   if (myData.pvChanged) {
+      SaveCachedPVValues(myData.huawei, 0);
+   }
+   return mqttReceived != 0;
+}
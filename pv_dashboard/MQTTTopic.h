@@ -0,0 +1,103 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file MQTTTopic.h
+  * 
+  * The topics of MQTT_TOPICS (Config.h) and their retained payloads as PVValues.
+  */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "PVRecord.h"
+
+/**
+  * Topic of one PVField.
+  */
+struct MQTTTopic
+{
+   const char *topic; //!< Retained topic on the broker
+   uint8_t     field; //!< PVField of the value
+};
+
+#define MQTT_TOPIC(topic, field) { topic, field },
+
+/* Topics of the MQTT_TOPICS in Config.h. */
+static const MQTTTopic mqttTopics[] = 
+{
+   MQTT_TOPICS(MQTT_TOPIC)
+};
+
+#define MQTT_TOPIC_COUNT (sizeof(mqttTopics) / sizeof(mqttTopics[0]))
+
+/* Parse a history array payload like [1.2,3.4,...], the entries after a short array are 0. */
+void ParseMQTTHistory(const char *payload, float values[])
+{
+   const char *pos = payload;
+   int         i;
+
+   for (i = 0; i < MAX_PV_HISTORY; i++) {
+      char *end;
+
+      while (*pos == '[' || *pos == ',' || *pos == ' ') pos++;
+      values[i] = strtod(pos, &end);
+      if (end == pos) {
+         break;
+      }
+      pos = end;
+   }
+   for (; i < MAX_PV_HISTORY; i++) {
+      values[i] = 0;
+   }
+}
+
+/* 
+ * Store one retained message into the fields of its topic and add them to
+ * values.mask. Returns the matching topics, bit n = mqttTopics[n], 0 for
+ * a topic which is not configured.
+ */
+uint32_t MQTTMessageToValues(const char *topic, const uint8_t *payload, size_t length, PVValues &values)
+{
+   char     value[128];
+   size_t   len     = length < sizeof(value) - 1 ? length : sizeof(value) - 1;
+   uint32_t matched = 0;
+
+   memcpy(value, payload, len); // the payload is not zero terminated
+   value[len] = 0;
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      if (strcmp(topic, mqttTopics[i].topic) != 0) {
+         continue;
+      }
+      int field = mqttTopics[i].field;
+
+      switch (pvSchema[field].type) {
+         case PV_TYPE_NUMBER:
+            values.scalar[field] = atof(value);
+            break;
+         case PV_TYPE_STATE:
+            strncpy(values.fveState, value, MAX_PV_STATE - 1);
+            values.fveState[MAX_PV_STATE - 1] = 0;
+            break;
+         case PV_TYPE_HISTORY:
+            ParseMQTTHistory(value, PVValuesHistory(values, field));
+            break;
+      }
+      values.mask |= 1UL << field;
+      matched     |= 1UL << i;
+   }
+   return matched;
+}
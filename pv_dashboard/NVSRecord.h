@@ -0,0 +1,176 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file NVSRecord.h
+  * 
+  * Helper functions to store versioned binary records in the non volatile memory.
+  * With a RECORD_LOG_PARTITION (see partitions.csv) the records go into the
+  * RecordLog and are written once per wake by CommitNVSRecords(), otherwise
+  * every save is a NVS blob commit. After a warm wake the copies in the RTC
+  * memory (see RTCRecord.h) are used first.
+  */
+#pragma once
+#include <nvs.h>
+#include "Utils.h"
+#include "RecordLog.h"
+#include "RTCRecord.h"
+#include "WakeArena.h"
+
+#define NVS_NAMESPACE "Setting"
+
+/**
+  * The pending records and the scan buffer of the RecordLog in the wakeArena.
+  */
+class RecordLogArena : public RecordLogAllocator
+{
+public:
+   void *Alloc(size_t size) { return wakeArena.Alloc(size); }
+   void  Free(void *data)   { wakeArena.Free(data); }
+};
+
+RecordLogArena     recordArena;              // memory of the record log
+RecordLogPartition recordPartition;          // flash partition of the record log
+RecordLog          recordLog(&recordArena);  // records of the partition
+bool               recordLogTried = false;   // the partition was searched
+
+/**
+  * Header in front of every stored record.
+  */
+struct NVSRecordHeader
+{
+   uint16_t version; //!< Layout version of the record data
+   uint16_t size;    //!< Size of the record data in bytes
+   uint32_t crc;     //!< CRC32 of the record data
+};
+
+/* Open the record log once, false if there is no partition for it. */
+bool OpenRecordLog()
+{
+   if (!recordLogTried) {
+      recordLogTried = true;
+      if (recordPartition.Begin() && recordLog.Open(recordPartition)) {
+         Serial.printf("Record log: generation %u, %u of %u bytes used\n",
+            recordLog.Generation(), recordLog.Used(), recordLog.BankSize());
+      } else {
+         Serial.println("No record log partition, using the NVS");
+      }
+   }
+   return recordLog.IsOpen();
+}
+
+/* Load a record and check its version, size and crc. */
+bool LoadNVSRecord(const char *key, uint16_t version, void *data, size_t size)
+{
+   nvs_handle nvs_arg;
+   size_t     blobSize = sizeof(NVSRecordHeader) + size;
+   uint8_t   *blob     = NULL;
+   bool       ret      = false;
+
+   if (LoadRTCRecord(key, version, data, size)) {
+      return true;
+   }
+   if (OpenRecordLog()) {
+      ret = recordLog.Load(key, version, data, size);
+      if (ret) {
+         SaveRTCRecord(key, version, data, size);
+      } else {
+         Serial.println("No valid record: " + String(key));
+      }
+      return ret;
+   }
+   blob = (uint8_t *) wakeArena.Alloc(blobSize);
+   if (!blob) {
+      return false;
+   }
+   if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_arg) == ESP_OK) {
+      if (nvs_get_blob(nvs_arg, key, blob, &blobSize) == ESP_OK && 
+          blobSize == sizeof(NVSRecordHeader) + size) {
+         NVSRecordHeader header;
+
+         memcpy(&header, blob, sizeof(header));
+         if (header.version == version && header.size == size &&
+             header.crc == Crc32(blob + sizeof(header), size)) {
+            memcpy(data, blob + sizeof(header), size);
+            ret = true;
+         }
+      }
+      nvs_close(nvs_arg);
+   }
+   wakeArena.Free(blob);
+   if (ret) {
+      SaveRTCRecord(key, version, data, size);
+   } else {
+      Serial.println("No valid NVS record: " + String(key));
+   }
+   return ret;
+}
+
+/* Store a record with its version, size and crc, the record log writes it in CommitNVSRecords(). */
+bool SaveNVSRecord(const char *key, uint16_t version, const void *data, size_t size)
+{
+   nvs_handle      nvs_arg;
+   size_t          blobSize = sizeof(NVSRecordHeader) + size;
+   uint8_t        *blob     = NULL;
+   NVSRecordHeader header;
+   bool            ret      = false;
+
+   SaveRTCRecord(key, version, data, size);
+   if (OpenRecordLog()) {
+      ret = recordLog.Save(key, version, data, size);
+      if (!ret) {
+         Serial.println("Saving record failed: " + String(key));
+      }
+      return ret;
+   }
+   blob = (uint8_t *) wakeArena.Alloc(blobSize);
+   if (!blob) {
+      return false;
+   }
+   header.version = version;
+   header.size    = size;
+   header.crc     = Crc32(data, size);
+   memcpy(blob, &header, sizeof(header));
+   memcpy(blob + sizeof(header), data, size);
+
+   if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_arg) == ESP_OK) {
+      ret = nvs_set_blob(nvs_arg, key, blob, blobSize) == ESP_OK &&
+            nvs_commit(nvs_arg) == ESP_OK;
+      nvs_close(nvs_arg);
+   }
+   wakeArena.Free(blob);
+   if (!ret) {
+      Serial.println("Saving NVS record failed: " + String(key));
+   }
+   return ret;
+}
+
+/* Write the records saved in this wake, once before the shutdown. */
+bool CommitNVSRecords()
+{
+   if (!recordLog.IsOpen()) {
+      return true;
+   }
+   uint32_t generation = recordLog.Generation();
+   bool     ret        = recordLog.Commit();
+
+   Serial.printf("Record log: %u of %u bytes used%s\n", 
+      recordLog.Used(), recordLog.BankSize(), generation != recordLog.Generation() ? ", compacted" : "");
+   if (!ret) {
+      Serial.println("Committing the record log failed");
+   }
+   return ret;
+}
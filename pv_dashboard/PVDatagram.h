@@ -0,0 +1,113 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file PVDatagram.h
+  * 
+  * UDP datagrams between the dashboard and a local gateway.
+  *
+  * Shared with gateway/pv_gateway.cpp and test/datagram_loopback.cpp.
+  *
+  * Layout (little endian):
+  *   'P' 'G'  magic
+  *   uint8    version
+  *   uint8    type (PGType)
+  *   uint32   sequence number of the snapshot
+  *   uint32   epoch, the start time of the gateway
+  *   uint16   payload length
+  *   uint16   reserved
+  *   uint32   CRC32 of the payload
+  *   payload  PG_PV: a PVRecord, PG_WEATHER: a WeatherRecord, PG_REQUEST: empty
+  *
+  * The sequence numbers count only within one epoch. A request of another
+  * epoch is answered with a full snapshot, and the dashboard drops its 
+  * base snapshot when the epoch of the gateway changes. The PG_WEATHER 
+  * datagram follows the PG_PV datagram, its seq counts the weather fetches
+  * of the gateway with a changed body.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Crc32.h"
+
+#define PG_VERSION      2
+#define PG_HEADER       20
+#define PG_MAX_DATAGRAM 1400
+
+/**
+  * Type of a datagram.
+  */
+enum PGType
+{
+   PG_REQUEST = 1, //!< Dashboard asks for the snapshot, seq and epoch of its last applied PV record
+   PG_PV      = 2, //!< PV record, sent as answer or as multicast beacon
+   PG_WEATHER = 3  //!< Weather record, sent behind the PV record
+};
+
+/**
+  * Decoded datagram header.
+  */
+struct PGHeader
+{
+   uint8_t  type;   //!< PGType
+   uint32_t seq;    //!< Sequence number of the snapshot
+   uint32_t epoch;  //!< Start time of the gateway
+   uint16_t length; //!< Payload length
+};
+
+/* Build a datagram in buf, returns its size or 0 if buf is too small. */
+size_t PGEncode(uint8_t *buf, size_t size, uint8_t type, uint32_t seq, uint32_t epoch, const uint8_t *payload, size_t length)
+{
+   uint32_t crc = Crc32(payload, length);
+
+   if (size < PG_HEADER + length || length > 0xffff) {
+      return 0;
+   }
+   buf[0] = 'P';
+   buf[1] = 'G';
+   buf[2] = PG_VERSION;
+   buf[3] = type;
+   for (int i = 0; i < 4; i++) buf[4 + i]  = (uint8_t) (seq >> (8 * i));
+   for (int i = 0; i < 4; i++) buf[8 + i]  = (uint8_t) (epoch >> (8 * i));
+   for (int i = 0; i < 2; i++) buf[12 + i] = (uint8_t) (length >> (8 * i));
+   buf[14] = 0;
+   buf[15] = 0;
+   for (int i = 0; i < 4; i++) buf[16 + i] = (uint8_t) (crc >> (8 * i));
+   if (length) {
+      memcpy(buf + PG_HEADER, payload, length);
+   }
+   return PG_HEADER + length;
+}
+
+/* Check a received datagram, the payload starts at buf + PG_HEADER. */
+bool PGDecode(const uint8_t *buf, size_t size, PGHeader &header)
+{
+   uint32_t crc = 0;
+
+   if (size < PG_HEADER || buf[0] != 'P' || buf[1] != 'G' || buf[2] != PG_VERSION) {
+      return false;
+   }
+   header.type   = buf[3];
+   header.seq    = 0;
+   header.epoch  = 0;
+   header.length = buf[12] | (buf[13] << 8);
+   for (int i = 0; i < 4; i++) header.seq   |= (uint32_t) buf[4 + i]  << (8 * i);
+   for (int i = 0; i < 4; i++) header.epoch |= (uint32_t) buf[8 + i]  << (8 * i);
+   for (int i = 0; i < 4; i++) crc          |= (uint32_t) buf[16 + i] << (8 * i);
+
+   return size == (size_t) PG_HEADER + header.length && crc == Crc32(buf + PG_HEADER, header.length);
+}
@@ -0,0 +1,210 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file PVRecord.h
+  * 
+  * Compact binary encoding of the PV values (content type application/x-pv-record).
+  *
+  * gateway/pv_gateway.cpp encodes the record with the same functions.
+  *
+  * Layout (little endian):
+  *   'P' 'V'  magic
+  *   uint8    version
+  *   uint8    reserved
+  *   uint32   mask of the fields that follow, bit n = PVField n
+  *   uint32   sequence number of this snapshot
+  *   uint32   sequence number the delta is based on, 0 for a full snapshot
+  *   fields   in PVField order, the numbers and the history entries as 
+  *            int16/int32 fixed point with the size and scale of pvSchema,
+  *            fve_state as uint8 length + chars.
+  *
+  * Delta protocol: the client sends the sequence number of its last applied
+  * snapshot in the PV_SEQ_HEADER request header. The server answers with the
+  * changed fields only and baseSeq set to that number, or with a full 
+  * snapshot (baseSeq 0) if it no longer knows the base.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "PVSchema.h"
+
+#define PV_RECORD_MIME     "application/x-pv-record"
+#define PV_RECORD_FORMAT   2
+#define PV_RECORD_HEADER   16
+#define PV_RECORD_MAX_SIZE 256
+#define PV_SEQ_HEADER      "X-PV-Seq"
+#define MAX_PV_STATE       24
+
+/**
+  * Decoded values of a PV record, only the fields in mask are valid.
+  */
+struct PVValues
+{
+   uint32_t mask;                          //!< Fields contained in the record
+   uint32_t seq;                           //!< Sequence number of the snapshot
+   uint32_t baseSeq;                       //!< Base sequence number of a delta, 0 for a full snapshot
+   double   scalar[PV_SCALAR_COUNT];       //!< All the scalar values
+   char     fveState[MAX_PV_STATE];        //!< Inverter state
+   float    historyPower[MAX_PV_HISTORY];  //!< Power consumption of the last days
+   float    historyYeld[MAX_PV_HISTORY];   //!< Yield of the last days
+};
+
+/* History array of a PV_TYPE_HISTORY field. */
+float *PVValuesHistory(PVValues &values, int field)
+{
+   return field == PV_HISTORY_POWER ? values.historyPower : values.historyYeld;
+}
+
+const float *PVValuesHistory(const PVValues &values, int field)
+{
+   return field == PV_HISTORY_POWER ? values.historyPower : values.historyYeld;
+}
+
+/* Write a little endian fixed point value, saturated to its size. */
+size_t PVPutFixed(uint8_t *buf, int bytes, double value, int scale)
+{
+   double  limit = bytes == 2 ? 32767.0 : 2147483647.0;
+   double  fixed = round(value * scale);
+   int32_t v;
+
+   if (fixed >  limit) fixed =  limit;
+   if (fixed < -limit) fixed = -limit;
+   v = (int32_t) fixed;
+   for (int i = 0; i < bytes; i++) {
+      buf[i] = (uint8_t) (v >> (8 * i));
+   }
+   return bytes;
+}
+
+/* Read a little endian fixed point value. */
+double PVGetFixed(const uint8_t *buf, int bytes, int scale)
+{
+   int32_t v = 0;
+
+   for (int i = 0; i < bytes; i++) {
+      v |= (int32_t) buf[i] << (8 * i);
+   }
+   if (bytes == 2) {
+      v = (int16_t) v;
+   }
+   return (double) v / scale;
+}
+
+/* Write a little endian uint32. */
+size_t PVPutU32(uint8_t *buf, uint32_t value)
+{
+   for (int i = 0; i < 4; i++) {
+      buf[i] = (uint8_t) (value >> (8 * i));
+   }
+   return 4;
+}
+
+/* Read a little endian uint32. */
+uint32_t PVGetU32(const uint8_t *buf)
+{
+   uint32_t value = 0;
+
+   for (int i = 0; i < 4; i++) {
+      value |= (uint32_t) buf[i] << (8 * i);
+   }
+   return value;
+}
+
+/* Encode the fields of values.mask into buf, returns the size or 0 if buf is too small. */
+size_t PVRecordEncode(const PVValues &values, uint8_t *buf, size_t size)
+{
+   size_t pos = 0;
+
+   if (size < PV_RECORD_HEADER) {
+      return 0;
+   }
+   buf[pos++] = 'P';
+   buf[pos++] = 'V';
+   buf[pos++] = PV_RECORD_FORMAT;
+   buf[pos++] = 0;
+   pos += PVPutU32(buf + pos, values.mask);
+   pos += PVPutU32(buf + pos, values.seq);
+   pos += PVPutU32(buf + pos, values.baseSeq);
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (!(values.mask & (1UL << field))) {
+         continue;
+      }
+      const PVFieldSchema &schema = pvSchema[field];
+
+      if (pos + PVFieldSize(field) > size) return 0;
+      if (schema.type == PV_TYPE_NUMBER) {
+         pos += PVPutFixed(buf + pos, schema.bytes, values.scalar[field], schema.scale);
+      } else if (schema.type == PV_TYPE_STATE) {
+         size_t len = strnlen(values.fveState, MAX_PV_STATE - 1);
+
+         if (pos + 1 + len > size) return 0;
+         buf[pos++] = (uint8_t) len;
+         memcpy(buf + pos, values.fveState, len);
+         pos += len;
+      } else {
+         const float *history = PVValuesHistory(values, field);
+
+         for (int i = 0; i < MAX_PV_HISTORY; i++) {
+            pos += PVPutFixed(buf + pos, schema.bytes, history[i], schema.scale);
+         }
+      }
+   }
+   return pos;
+}
+
+/* Decode a record into values, returns false on a malformed record. */
+bool PVRecordDecode(const uint8_t *buf, size_t len, PVValues &values)
+{
+   size_t pos = PV_RECORD_HEADER;
+
+   if (len < PV_RECORD_HEADER || buf[0] != 'P' || buf[1] != 'V' || buf[2] != PV_RECORD_FORMAT) {
+      return false;
+   }
+   values.mask    = PVGetU32(buf + 4);
+   values.seq     = PVGetU32(buf + 8);
+   values.baseSeq = PVGetU32(buf + 12);
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (!(values.mask & (1UL << field))) {
+         continue;
+      }
+      const PVFieldSchema &schema = pvSchema[field];
+
+      if (schema.type == PV_TYPE_NUMBER) {
+         if (pos + schema.bytes > len) return false;
+         values.scalar[field] = PVGetFixed(buf + pos, schema.bytes, schema.scale);
+         pos += schema.bytes;
+      } else if (schema.type == PV_TYPE_STATE) {
+         size_t strLen = pos < len ? buf[pos++] : MAX_PV_STATE;
+
+         if (strLen >= MAX_PV_STATE || pos + strLen > len) return false;
+         memcpy(values.fveState, buf + pos, strLen);
+         values.fveState[strLen] = 0;
+         pos += strLen;
+      } else {
+         float *history = PVValuesHistory(values, field);
+
+         if (pos + PVFieldSize(field) > len) return false;
+         for (int i = 0; i < MAX_PV_HISTORY; i++) {
+            history[i] = PVGetFixed(buf + pos, schema.bytes, schema.scale);
+            pos += schema.bytes;
+         }
+      }
+   }
+   return pos == len;
+}
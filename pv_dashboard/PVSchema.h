@@ -0,0 +1,149 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file PVSchema.h
+  * 
+  * The single definition of all the PV fields.
+  *
+  * Every row of PV_SCHEMA generates the PVField, the json key, the fixed 
+  * point format of the record and the snapshot, the Huawei member, the unit
+  * of the dump and the refresh policy. A new meter value is one more NUMBER
+  * row in front of PV_FVE_STATE.
+  *
+  * Columns:
+  *   field     PVField, bit of the change masks and the record
+  *   member    Huawei member
+  *   type      NUMBER (double), STATE (FveState) or HISTORY (MAX_PV_HISTORY floats)
+  *   key       json key of the http response and the gateway
+  *   bytes     size of the fixed point integer, of one entry for a HISTORY
+  *   scale     value * scale is stored
+  *   unit      unit of the dump
+  *   absolute, relative, maxStale  refresh thresholds, see FieldPolicy
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MAX_PV_HISTORY 8
+
+#define PV_SCHEMA(X) \
+   /* field               member           type     key                          bytes scale unit    absolute relative maxStale */ \
+   X(PV_PANEL_POWER,      panelPower,      NUMBER,  "fve_active_power",          4,      1, "W",    50.0, 0.05,      60 * 60) \
+   X(PV_YIELD_TODAY,      yieldToday,      NUMBER,  "fve_daily_yield_energy",    4,    100, "kWh",   0.1, 0,         60 * 60) \
+   X(PV_POWER,            power,           NUMBER,  "shelly_huawei_power",       4,      1, "W",    50.0, 0.05,      60 * 60) \
+   X(PV_GRID_POWER,       grid_power,      NUMBER,  "power_meter_active_power",  4,      1, "W",    50.0, 0.05,      60 * 60) \
+   X(PV_BOILER_STATUS,    boiler_status,   NUMBER,  "boiler_status",             2,      1, "",      0,   0,         0      ) \
+   X(PV_BOILER_POWER,     boiler_power,    NUMBER,  "boiler_power",              4,      1, "W",    50.0, 0.05,      60 * 60) \
+   X(PV_BOILER_WATER,     boiler_water,    NUMBER,  "boiler_water",              2,     10, "C",     1.0, 0,     3 * 60 * 60) \
+   X(PV_GRID_L1_POWER,    grid_l1_power,   NUMBER,  "l1_power",                  4,     10, "W",    30.0, 0.10,      60 * 60) \
+   X(PV_GRID_L1_VOLTAGE,  grid_l1_voltage, NUMBER,  "l1_voltage",                2,     10, "V",     2.0, 0,     3 * 60 * 60) \
+   X(PV_GRID_L1_CURRENT,  grid_l1_current, NUMBER,  "l1_current",                2,    100, "A",     0.2, 0.10,      60 * 60) \
+   X(PV_GRID_L2_POWER,    grid_l2_power,   NUMBER,  "l2_power",                  4,     10, "W",    30.0, 0.10,      60 * 60) \
+   X(PV_GRID_L2_VOLTAGE,  grid_l2_voltage, NUMBER,  "l2_voltage",                2,     10, "V",     2.0, 0,     3 * 60 * 60) \
+   X(PV_GRID_L2_CURRENT,  grid_l2_current, NUMBER,  "l2_current",                2,    100, "A",     0.2, 0.10,      60 * 60) \
+   X(PV_GRID_L3_POWER,    grid_l3_power,   NUMBER,  "l3_power",                  4,     10, "W",    30.0, 0.10,      60 * 60) \
+   X(PV_GRID_L3_VOLTAGE,  grid_l3_voltage, NUMBER,  "l3_voltage",                2,     10, "V",     2.0, 0,     3 * 60 * 60) \
+   X(PV_GRID_L3_CURRENT,  grid_l3_current, NUMBER,  "l3_current",                2,    100, "A",     0.2, 0.10,      60 * 60) \
+   X(PV_PV1_VOLTAGE,      pv1_voltage,     NUMBER,  "fve_pv_01_voltage",         2,     10, "V",     5.0, 0.05,      60 * 60) \
+   X(PV_PV1_CURRENT,      pv1_current,     NUMBER,  "fve_pv_01_current",         2,    100, "A",     0.2, 0.05,      60 * 60) \
+   X(PV_PV2_VOLTAGE,      pv2_voltage,     NUMBER,  "fve_pv_02_voltage",         2,     10, "V",     5.0, 0.05,      60 * 60) \
+   X(PV_PV2_CURRENT,      pv2_current,     NUMBER,  "fve_pv_02_current",         2,    100, "A",     0.2, 0.05,      60 * 60) \
+   X(PV_PV_PEAK,          pv_peak,         NUMBER,  "fve_day_active_power_peak", 4,      1, "W",    50.0, 0,         60 * 60) \
+   X(PV_GAS,              gas,             NUMBER,  "gas",                       4,    100, "m3",    0.1, 0,     6 * 60 * 60) \
+   X(PV_WATER,            water,           NUMBER,  "water",                     4,      1, "l",    10.0, 0,     6 * 60 * 60) \
+   X(PV_ELEKTRIKA,        elektrika,       NUMBER,  "power",                     4,    100, "kWh",   0.1, 0,     6 * 60 * 60) \
+   X(PV_TEMP,             temp,            NUMBER,  "temp",                      2,     10, "C",     0.5, 0,     6 * 60 * 60) \
+   X(PV_FVE_STATE,        fve_state,       STATE,   "fve_state",                 1,      1, "",      0,   0,         0      ) \
+   X(PV_HISTORY_POWER,    historyPower,    HISTORY, "power_history",             2,    100, "kWh",   0.1, 0.05,  6 * 60 * 60) \
+   X(PV_HISTORY_YELD,     historyYeld,     HISTORY, "yeld_history",              2,    100, "kWh",   0.1, 0.05,  6 * 60 * 60)
+
+/**
+  * Value type of a PVField.
+  */
+enum PVFieldType
+{
+   PV_TYPE_NUMBER,  //!< double
+   PV_TYPE_STATE,   //!< FveState
+   PV_TYPE_HISTORY, //!< MAX_PV_HISTORY floats
+};
+
+#define PV_SCHEMA_FIELD(field, ...) field,
+
+/**
+  * All the fields of the PV record. The numbers come first.
+  */
+enum PVField
+{
+   PV_SCHEMA(PV_SCHEMA_FIELD)
+   PV_FIELD_COUNT,
+   PV_SCALAR_COUNT = PV_FVE_STATE
+};
+
+#define PV_ALL_FIELDS ((uint32_t) ((1UL << PV_FIELD_COUNT) - 1))
+
+/**
+  * Description of one PVField.
+  */
+struct PVFieldSchema
+{
+   const char *key;   //!< Json key
+   const char *unit;  //!< Unit of the dump
+   uint8_t     type;  //!< PVFieldType
+   uint8_t     bytes; //!< Fixed point size, of one entry for a history
+   int16_t     scale; //!< value * scale is stored
+};
+
+#define PV_SCHEMA_ENTRY(field, member, type, key, bytes, scale, unit, ...) { key, unit, PV_TYPE_##type, bytes, scale },
+
+static constexpr PVFieldSchema pvSchema[PV_FIELD_COUNT] = 
+{
+   PV_SCHEMA(PV_SCHEMA_ENTRY)
+};
+
+/* Fixed point size of the whole field. */
+constexpr size_t PVFieldSize(int field)
+{
+   return pvSchema[field].type == PV_TYPE_HISTORY ? pvSchema[field].bytes * MAX_PV_HISTORY : pvSchema[field].bytes;
+}
+
+/* Offset of the field in the packed snapshot, the size of the snapshot for PV_FIELD_COUNT. */
+constexpr size_t PVFieldOffset(int field)
+{
+   return field == 0 ? 0 : PVFieldOffset(field - 1) + PVFieldSize(field - 1);
+}
+
+/* The fields of the PV record are numbers up to PV_SCALAR_COUNT. */
+constexpr bool PVScalarsFirst(int field)
+{
+   return field == PV_FIELD_COUNT || 
+          ((pvSchema[field].type == PV_TYPE_NUMBER) == (field < PV_SCALAR_COUNT) && PVScalarsFirst(field + 1));
+}
+
+static_assert(PVScalarsFirst(0),                  "PV_SCHEMA: the NUMBER rows come first");
+static_assert(PV_FIELD_COUNT <= 32,               "PV_SCHEMA: the masks are uint32");
+
+/* PVField of a json key, -1 for an unknown key. */
+int PVFieldOfKey(const char *key)
+{
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (strcmp(key, pvSchema[field].key) == 0) {
+         return field;
+      }
+   }
+   return -1;
+}
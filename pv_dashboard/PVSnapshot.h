@@ -0,0 +1,193 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file PVSnapshot.h
+  * 
+  * Packed fixed point snapshot of the PV values for the caches, the diffs
+  * and the transports.
+  *
+  * The fields follow each other in PVField order without padding, with the
+  * size and scale of pvSchema, so a snapshot field holds exactly the integer
+  * of the PV record.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "PVRecord.h"
+
+/**
+  * Inverter state, parsed from the fve_state text of the inverter.
+  */
+enum FveState
+{
+   FVE_UNKNOWN,
+   FVE_STANDBY,
+   FVE_STARTING,
+   FVE_ON_GRID,
+   FVE_LIMITED,
+   FVE_GRID_SCHEDULING,
+   FVE_OFF_GRID,
+   FVE_SELF_CHECK,
+   FVE_SHUTDOWN,
+   FVE_FAULT,
+   FVE_STATE_COUNT
+};
+
+static const char *fveStateName[FVE_STATE_COUNT] = 
+{
+   "Unknown",
+   "Standby",
+   "Starting",
+   "On-grid",
+   "Power limited",
+   "Grid scheduling",
+   "Off-grid",
+   "Self check",
+   "Shutdown",
+   "Fault",
+};
+
+/**
+  * Text patterns of the inverter states, the first match wins.
+  */
+struct FveStatePattern
+{
+   const char *pattern; //!< Lower case part of the state text
+   uint8_t     state;   //!< FveState
+};
+
+static const FveStatePattern fveStatePattern[] = 
+{
+   { "fault",           FVE_FAULT           },
+   { "shutdown",        FVE_SHUTDOWN        },
+   { "limited",         FVE_LIMITED         },
+   { "derating",        FVE_LIMITED         },
+   { "off-grid",        FVE_OFF_GRID        },
+   { "on-grid",         FVE_ON_GRID         },
+   { "grid-connected",  FVE_ON_GRID         },
+   { "grid connected",  FVE_ON_GRID         },
+   { "grid scheduling", FVE_GRID_SCHEDULING },
+   { "standby",         FVE_STANDBY         },
+   { "start",           FVE_STARTING        },
+   { "check",           FVE_SELF_CHECK      },
+   { "inspect",         FVE_SELF_CHECK      },
+   { "scanning",        FVE_SELF_CHECK      },
+   { "detection",       FVE_SELF_CHECK      },
+};
+
+#define PV_SNAPSHOT_OFFSET(field, ...) PVFieldOffset(field),
+
+/**
+  * All the PV values in the fixed point of the PV record.
+  */
+struct PVSnapshot
+{
+   uint8_t data[PVFieldOffset(PV_FIELD_COUNT)]; //!< Little endian fields at pvSnapshotOffset
+};
+
+/* Offset of every PVField in the snapshot. */
+static const uint8_t pvSnapshotOffset[PV_FIELD_COUNT] = 
+{
+   PV_SCHEMA(PV_SNAPSHOT_OFFSET)
+};
+
+static_assert(sizeof(PVSnapshot) <= 255, "PVSnapshot offsets are uint8");
+
+/* FveState of an inverter state text. */
+uint8_t FveStateFromString(const char *text)
+{
+   char lower[MAX_PV_STATE];
+   int  i;
+
+   for (i = 0; text[i] && i < MAX_PV_STATE - 1; i++) {
+      lower[i] = tolower((unsigned char) text[i]);
+   }
+   lower[i] = 0;
+   for (size_t p = 0; p < sizeof(fveStatePattern) / sizeof(fveStatePattern[0]); p++) {
+      if (strstr(lower, fveStatePattern[p].pattern)) {
+         return fveStatePattern[p].state;
+      }
+   }
+   return FVE_UNKNOWN;
+}
+
+/* Display text of a FveState. */
+const char *FveStateName(uint8_t state)
+{
+   return state < FVE_STATE_COUNT ? fveStateName[state] : fveStateName[FVE_UNKNOWN];
+}
+
+/* Store a number or the state, saturated to the field size. */
+void PVSnapshotSet(PVSnapshot &snapshot, int field, double value)
+{
+   PVPutFixed(snapshot.data + pvSnapshotOffset[field], pvSchema[field].bytes, value, pvSchema[field].scale);
+}
+
+/* Read a number or the state. */
+double PVSnapshotGet(const PVSnapshot &snapshot, int field)
+{
+   return PVGetFixed(snapshot.data + pvSnapshotOffset[field], pvSchema[field].bytes, pvSchema[field].scale);
+}
+
+/* Store a value already in fixed point, entry index of a history, saturated to the field size. */
+void PVSnapshotPut(PVSnapshot &snapshot, int field, int index, int32_t fixed)
+{
+   const PVFieldSchema &schema = pvSchema[field];
+   int32_t              limit  = schema.bytes == 1 ? 255 : (schema.bytes == 2 ? 32767 : 2147483647);
+   uint8_t             *p      = snapshot.data + pvSnapshotOffset[field] + index * schema.bytes;
+
+   fixed = fixed > limit ? limit : (fixed < -limit ? -limit : fixed);
+   for (int i = 0; i < schema.bytes; i++) {
+      p[i] = (uint8_t) (fixed >> (8 * i));
+   }
+}
+
+/* Store the MAX_PV_HISTORY values of a history. */
+void PVSnapshotSetHistory(PVSnapshot &snapshot, int field, const float *values)
+{
+   uint8_t *p = snapshot.data + pvSnapshotOffset[field];
+
+   for (int i = 0; i < MAX_PV_HISTORY; i++) {
+      p += PVPutFixed(p, pvSchema[field].bytes, values[i], pvSchema[field].scale);
+   }
+}
+
+/* Read the MAX_PV_HISTORY values of a history. */
+void PVSnapshotGetHistory(const PVSnapshot &snapshot, int field, float *values)
+{
+   const uint8_t *p = snapshot.data + pvSnapshotOffset[field];
+
+   for (int i = 0; i < MAX_PV_HISTORY; i++, p += pvSchema[field].bytes) {
+      values[i] = PVGetFixed(p, pvSchema[field].bytes, pvSchema[field].scale);
+   }
+}
+
+/* Mask of the PVFields which differ between the two snapshots. */
+uint32_t PVSnapshotDiff(const PVSnapshot &a, const PVSnapshot &b)
+{
+   uint32_t changed = 0;
+
+   for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (memcmp(a.data + pvSnapshotOffset[field], b.data + pvSnapshotOffset[field], PVFieldSize(field)) != 0) {
+         changed |= 1UL << field;
+      }
+   }
+   return changed;
+}
@@ -0,0 +1,131 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file RTCRecord.h
+  * 
+  * Copies of the small records in the RTC slow memory for the warm wakes.
+  *
+  * The RTC memory survives the deep sleep but not the shutdown of the 
+  * M5Paper. After a warm wake the records of the previous wake are read 
+  * from here instead of the flash. Every save replaces the copy, records 
+  * larger than RTC_RECORD_MAX or not fitting into the arena are only in 
+  * the flash.
+  */
+#pragma once
+#include "Crc32.h"
+#include "RecordLog.h"
+
+#define RTC_RECORD_MAGIC  0x43545257 // "WRTC"
+#define RTC_RECORD_ARENA  4096       // bytes of RTC slow memory for the copies
+#define RTC_RECORD_MAX    1024       // largest record kept in the RTC memory
+
+/**
+  * Header in front of every copy.
+  */
+struct RTCRecordHeader
+{
+   char     key[RECORD_LOG_KEY]; //!< Zero terminated key
+   uint16_t version;             //!< Layout version of the record data
+   uint16_t size;                //!< Size of the record data in bytes
+   uint32_t crc;                 //!< CRC32 of the record data
+};
+
+/**
+  * The arena with the packed copies.
+  */
+struct RTCRecordArena
+{
+   uint32_t magic;                  //!< RTC_RECORD_MAGIC if the arena is valid
+   uint32_t used;                   //!< Used bytes of data
+   uint8_t  data[RTC_RECORD_ARENA]; //!< RTCRecordHeader + data, 4 byte aligned
+};
+
+RTC_DATA_ATTR RTCRecordArena rtcRecords; // survives the deep sleep
+
+/* Bytes of a copy in the arena. */
+static uint32_t RTCRecordSize(uint16_t size)
+{
+   return (sizeof(RTCRecordHeader) + size + 3) & ~3;
+}
+
+/* Empty the arena, after a cold boot the RTC memory is not valid. */
+void ClearRTCRecords()
+{
+   rtcRecords.magic = RTC_RECORD_MAGIC;
+   rtcRecords.used  = 0;
+}
+
+/* Offset of the copy of a key, -1 if there is none. */
+static int FindRTCRecord(const char *key)
+{
+   if (rtcRecords.magic != RTC_RECORD_MAGIC || rtcRecords.used > RTC_RECORD_ARENA) {
+      ClearRTCRecords();
+   }
+   for (uint32_t pos = 0; pos < rtcRecords.used; ) {
+      RTCRecordHeader *header = (RTCRecordHeader *) (rtcRecords.data + pos);
+
+      if (strncmp(header->key, key, RECORD_LOG_KEY) == 0) {
+         return pos;
+      }
+      pos += RTCRecordSize(header->size);
+   }
+   return -1;
+}
+
+/* Load the copy of a record and check its version, size and crc. */
+bool LoadRTCRecord(const char *key, uint16_t version, void *data, size_t size)
+{
+   int pos = FindRTCRecord(key);
+
+   if (pos < 0) {
+      return false;
+   }
+   RTCRecordHeader *header = (RTCRecordHeader *) (rtcRecords.data + pos);
+
+   if (header->version != version || header->size != size ||
+       header->crc != Crc32(header + 1, size)) {
+      return false;
+   }
+   memcpy(data, header + 1, size);
+   return true;
+}
+
+/* Replace the copy of a record, a record which does not fit is dropped. */
+void SaveRTCRecord(const char *key, uint16_t version, const void *data, size_t size)
+{
+   int pos = FindRTCRecord(key);
+
+   if (pos >= 0) {
+      uint32_t length = RTCRecordSize(((RTCRecordHeader *) (rtcRecords.data + pos))->size);
+
+      memmove(rtcRecords.data + pos, rtcRecords.data + pos + length, rtcRecords.used - pos - length);
+      rtcRecords.used -= length;
+   }
+   if (size > RTC_RECORD_MAX || strlen(key) >= RECORD_LOG_KEY ||
+       rtcRecords.used + RTCRecordSize(size) > RTC_RECORD_ARENA) {
+      return;
+   }
+   RTCRecordHeader *header = (RTCRecordHeader *) (rtcRecords.data + rtcRecords.used);
+
+   memset(header->key, 0, sizeof(header->key));
+   strcpy(header->key, key);
+   header->version = version;
+   header->size    = size;
+   header->crc     = Crc32(data, size);
+   memcpy(header + 1, data, size);
+   rtcRecords.used += RTCRecordSize(size);
+}
@@ -21,17 +21,19 @@
   */
 #pragma once
 #include "time.h"
+#include "WakeBudget.h"
+#include "WarmWake.h"
 
 /* Update the internal rtc */
-void updateRTC() 
+bool updateRTC() 
 {
   rtc_date_t RTCDate;
   rtc_time_t RTCtime;
   struct tm  timeinfo;
   
-  if (!getLocalTime(&timeinfo)) {
+  if (!getLocalTime(&timeinfo, wakeBudget.Remaining())) {
     Serial.println("Failed to obtain time");
-    return;
+    return false;
   }
 
   RTCtime.hour = timeinfo.tm_hour;
@@ -43,14 +45,23 @@ void updateRTC()
   RTCDate.mon  = timeinfo.tm_mon + 1;
   RTCDate.day  = timeinfo.tm_mday;
   M5.RTC.setDate(&RTCDate);
+  return true;
 }
 
-/* Set the internal RTC clock with the weather timestamp */
+/* Set the internal RTC clock with the weather timestamp, a warm wake syncs every NTP_SYNC_INTERVAL */
 void UpdateRTCFromNTP()
 {
+   if (warmWake && warmState.ntpTime && GetRTCTime() - (time_t) warmState.ntpTime < NTP_SYNC_INTERVAL) {
+      setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+      tzset();
+      Serial.println("NTP sync skipped");
+      return;
+   }
    configTime(0, 3600, "pool.ntp.org");
    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
    tzset();
 
-   updateRTC();
+   if (updateRTC()) {
+      warmState.ntpTime = GetRTCTime();
+   }
 }
@@ -0,0 +1,685 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file RecordLog.h
+  * 
+  * Append only store for the versioned binary records of the wakes.
+  *
+  * The storage is split into two banks. Only one bank is active, it starts
+  * with a RecordLogBank header and is followed by the appended records. A
+  * record replaces the older records with the same key. Saved records are 
+  * kept in memory and appended together by Commit(), once per wake, an 
+  * unchanged record is not written at all. If the active bank is full, 
+  * Compact() copies the newest record of every key into the other bank and
+  * writes its bank header last with the next generation. So the flash is 
+  * only erased one bank at a time, both banks wear evenly and a power loss 
+  * leaves either the old or the new bank valid. Every commit and every 
+  * compaction ends with a RECORD_LOG_COMMIT marker. Open() scans the active
+  * bank and takes over the records of complete batches only, a record with
+  * a bad crc or a batch without its marker ends the scan and the next 
+  * commit compacts.
+  *
+  * RecordLogPartition stores the log in a flash partition, RecordLogFile in
+  * a file for test/record_log_test.cpp. The saved records and the scan 
+  * buffer come from a RecordLogAllocator.
+  */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Crc32.h"
+
+#define RECORD_LOG_BANK_MAGIC   0x474f4c52 // "RLOG"
+#define RECORD_LOG_MAGIC        0x5243     // "CR"
+#define RECORD_LOG_COMMIT       0x4d43     // "CM", end of a batch
+#define RECORD_LOG_ERASED       0xffff     // magic of the free space
+#define RECORD_LOG_KEY          16         // key length incl. the terminator
+#define RECORD_LOG_ENTRIES      24         // max number of keys
+#define RECORD_LOG_SECTOR       4096       // erase unit of the flash
+
+/**
+  * Access to the raw storage, erased bytes read as 0xff.
+  */
+class RecordLogStorage
+{
+public:
+   virtual ~RecordLogStorage() {}
+
+   virtual uint32_t Size() = 0;
+   virtual bool     Read (uint32_t offset, void *data, size_t size) = 0;
+   virtual bool     Write(uint32_t offset, const void *data, size_t size) = 0;
+   virtual bool     Erase(uint32_t offset, uint32_t size) = 0;
+};
+
+/**
+  * Memory of the saved records and of the read buffers, the heap by default.
+  */
+class RecordLogAllocator
+{
+public:
+   virtual ~RecordLogAllocator() {}
+
+   virtual void *Alloc(size_t size) { return malloc(size); }
+   virtual void  Free(void *data)   { free(data); }
+};
+
+/**
+  * Header at the start of the active bank.
+  */
+struct RecordLogBank
+{
+   uint32_t magic;      //!< RECORD_LOG_BANK_MAGIC
+   uint32_t generation; //!< Incremented by every compaction
+   uint32_t crc;        //!< CRC32 of magic and generation
+   uint32_t reserved;   //!< Keeps the records 16 byte aligned
+};
+
+/**
+  * Header in front of every record. The RECORD_LOG_COMMIT marker is a 
+  * header without key and data, its version is the number of records of
+  * the batch.
+  */
+struct RecordLogHeader
+{
+   uint16_t magic;                //!< RECORD_LOG_MAGIC or RECORD_LOG_COMMIT
+   uint16_t version;              //!< Layout version of the record data
+   uint16_t size;                 //!< Size of the record data in bytes
+   uint16_t reserved;             //!< 0xffff
+   char     key[RECORD_LOG_KEY];  //!< Zero terminated key
+   uint32_t crc;                  //!< CRC32 of the header fields above and the data
+};
+
+/**
+  * Newest record of a key.
+  */
+struct RecordLogEntry
+{
+   char      key[RECORD_LOG_KEY]; //!< Zero terminated key
+   uint16_t  version;             //!< Layout version of the record data
+   uint16_t  size;                //!< Size of the record data in bytes
+   uint32_t  offset;              //!< Data offset in the active bank, 0 if not yet committed
+   uint32_t  crc;                 //!< Crc of the record
+   uint8_t  *pending;             //!< Saved data waiting for Commit(), NULL if committed
+};
+
+/**
+  * RecordLog: Key value store of versioned records on a RecordLogStorage.
+  */
+class RecordLog
+{
+protected:
+   RecordLogStorage   *storage_;    //!< The raw storage, NULL if not open
+   RecordLogAllocator  heap_;       //!< Default allocator
+   RecordLogAllocator *alloc_;      //!< Memory of the pending records and buffers
+   uint32_t            bankSize_;   //!< Size of one bank
+   int                 bank_;       //!< Index of the active bank
+   uint32_t            generation_; //!< Generation of the active bank
+   uint32_t            tail_;       //!< Offset of the free space in the active bank
+   int                 count_;      //!< Used entries
+   RecordLogEntry      entries_[RECORD_LOG_ENTRIES];
+
+protected:
+   /* Stored size of a record, 4 byte aligned. */
+   static uint32_t RecordSize(uint16_t size)
+   {
+      return (sizeof(RecordLogHeader) + size + 3) & ~3;
+   }
+
+   /* Header of an entry. */
+   static RecordLogHeader Header(const RecordLogEntry &entry)
+   {
+      RecordLogHeader header;
+
+      memset(&header, 0, sizeof(header));
+      header.magic    = RECORD_LOG_MAGIC;
+      header.version  = entry.version;
+      header.size     = entry.size;
+      header.reserved = 0xffff;
+      memcpy(header.key, entry.key, RECORD_LOG_KEY);
+      return header;
+   }
+
+   /* Crc of a record. */
+   static uint32_t RecordCrc(const RecordLogHeader &header, const void *data)
+   {
+      return Crc32(data, header.size, Crc32(&header, offsetof(RecordLogHeader, crc)));
+   }
+
+   /* Crc of a bank header. */
+   static uint32_t BankCrc(const RecordLogBank &bank)
+   {
+      return Crc32(&bank, offsetof(RecordLogBank, crc));
+   }
+
+   uint32_t BankStart(int bank)
+   {
+      return bank * bankSize_;
+   }
+
+   /* Read the bank header, false if the bank is not valid. */
+   bool ReadBank(int bank, RecordLogBank &header)
+   {
+      return storage_->Read(BankStart(bank), &header, sizeof(header)) &&
+             header.magic == RECORD_LOG_BANK_MAGIC && header.crc == BankCrc(header);
+   }
+
+   /* Entry of a key, NULL if there is none. */
+   RecordLogEntry *Find(const char *key)
+   {
+      for (int i = 0; i < count_; i++) {
+         if (strncmp(entries_[i].key, key, RECORD_LOG_KEY) == 0) {
+            return &entries_[i];
+         }
+      }
+      return NULL;
+   }
+
+   /* Entry of a key, a new one if there is none. */
+   RecordLogEntry *Add(const char *key)
+   {
+      RecordLogEntry *entry = Find(key);
+
+      if (entry || count_ == RECORD_LOG_ENTRIES || strlen(key) >= RECORD_LOG_KEY) {
+         return entry;
+      }
+      entry = &entries_[count_++];
+      memset(entry, 0, sizeof(*entry));
+      strcpy(entry->key, key);
+      return entry;
+   }
+
+   /* Read the committed data of an entry from the active bank and check it. */
+   bool ReadData(const RecordLogEntry &entry, void *data)
+   {
+      return entry.offset &&
+             storage_->Read(BankStart(bank_) + entry.offset, data, entry.size) &&
+             RecordCrc(Header(entry), data) == entry.crc;
+   }
+
+   /* Append a record at offset of a bank. The header goes first, an interrupted write leaves a bad crc. */
+   bool WriteRecord(int bank, uint32_t offset, const RecordLogEntry &entry, const void *data)
+   {
+      RecordLogHeader header = Header(entry);
+      uint32_t        start  = BankStart(bank) + offset;
+
+      header.crc = entry.crc;
+      return storage_->Write(start, &header, sizeof(header)) &&
+             storage_->Write(start + sizeof(header), data, entry.size);
+   }
+
+   /* Append the RECORD_LOG_COMMIT marker of a batch of count records. */
+   bool WriteCommit(int bank, uint32_t offset, int count)
+   {
+      RecordLogHeader header;
+
+      memset(&header, 0, sizeof(header));
+      header.magic    = RECORD_LOG_COMMIT;
+      header.version  = count;
+      header.reserved = 0xffff;
+      header.crc      = RecordCrc(header, NULL);
+      return storage_->Write(BankStart(bank) + offset, &header, sizeof(header));
+   }
+
+   /* A buffer of at least size bytes, replaces data if that is smaller. */
+   uint8_t *Grow(uint8_t *data, size_t &capacity, size_t size)
+   {
+      if (data && size <= capacity) {
+         return data;
+      }
+      alloc_->Free(data);
+      data     = (uint8_t *) alloc_->Alloc(size ? size : 1);
+      capacity = data ? size : 0;
+      return data;
+   }
+
+   /* Build the entries from the records of the complete batches of the active bank. */
+   void Scan()
+   {
+      RecordLogHeader header;
+      RecordLogEntry  batch[RECORD_LOG_ENTRIES];
+      int             count    = 0;
+      bool            damaged  = false;
+      uint8_t        *data     = NULL;
+      size_t          capacity = 0;
+
+      tail_ = sizeof(RecordLogBank);
+      while (tail_ + sizeof(header) <= bankSize_ && 
+             storage_->Read(BankStart(bank_) + tail_, &header, sizeof(header)) &&
+             header.magic != RECORD_LOG_ERASED) {
+         bool valid = (header.magic == RECORD_LOG_MAGIC || header.magic == RECORD_LOG_COMMIT) && 
+                      tail_ + RecordSize(header.size) <= bankSize_ &&
+                      header.key[RECORD_LOG_KEY - 1] == 0;
+
+         if (valid) {
+            data  = Grow(data, capacity, header.size);
+            valid = data && storage_->Read(BankStart(bank_) + tail_ + sizeof(header), data, header.size) &&
+                    RecordCrc(header, data) == header.crc;
+         }
+         if (valid && header.magic == RECORD_LOG_COMMIT) {
+            valid = header.size == 0 && header.version == count;
+            for (int i = 0; valid && i < count; i++) {
+               RecordLogEntry *entry = Add(batch[i].key);
+
+               if (entry) {
+                  *entry = batch[i];
+               }
+            }
+            count = 0;
+         } else if (valid && count < RECORD_LOG_ENTRIES) {
+            RecordLogEntry &entry = batch[count++];
+
+            memset(&entry, 0, sizeof(entry));
+            strcpy(entry.key, header.key);
+            entry.version = header.version;
+            entry.size    = header.size;
+            entry.offset  = tail_ + sizeof(header);
+            entry.crc     = header.crc;
+         } else {
+            valid = false;
+         }
+         if (!valid) {
+            damaged = true;
+            break;
+         }
+         tail_ += RecordSize(header.size);
+      }
+      if (damaged || count) {
+         tail_ = bankSize_; // interrupted write or commit, the next commit compacts
+      }
+      alloc_->Free(data);
+   }
+
+   /* Start an empty log in bank 0. */
+   bool Format()
+   {
+      RecordLogBank header;
+
+      if (!storage_->Erase(BankStart(0), bankSize_)) {
+         return false;
+      }
+      header.magic      = RECORD_LOG_BANK_MAGIC;
+      header.generation = 1;
+      header.crc        = BankCrc(header);
+      header.reserved   = 0xffffffff;
+      bank_       = 0;
+      generation_ = 1;
+      tail_       = sizeof(header);
+      return storage_->Write(BankStart(0), &header, sizeof(header));
+   }
+
+public:
+   /* The log with the memory of allocator, NULL for the heap. */
+   RecordLog(RecordLogAllocator *allocator = NULL)
+      : storage_(NULL)
+      , alloc_(allocator ? allocator : &heap_)
+      , bankSize_(0)
+      , bank_(0)
+      , generation_(0)
+      , tail_(0)
+      , count_(0)
+   {
+   }
+
+   ~RecordLog()
+   {
+      for (int i = 0; i < count_; i++) {
+         alloc_->Free(entries_[i].pending);
+      }
+   }
+
+   bool IsOpen()
+   {
+      return storage_ != NULL;
+   }
+
+   /* Bytes used in the active bank. */
+   uint32_t Used()
+   {
+      return tail_;
+   }
+
+   /* Size of one bank. */
+   uint32_t BankSize()
+   {
+      return bankSize_;
+   }
+
+   /* Generation of the active bank, the number of compactions + 1. */
+   uint32_t Generation()
+   {
+      return generation_;
+   }
+
+   /* Recover the newest valid bank or start an empty log. */
+   bool Open(RecordLogStorage &storage)
+   {
+      RecordLogBank bank[2];
+
+      storage_  = &storage;
+      bankSize_ = storage.Size() / 2 / RECORD_LOG_SECTOR * RECORD_LOG_SECTOR;
+      count_    = 0;
+      if (bankSize_ == 0) {
+         storage_ = NULL;
+         return false;
+      }
+      bool valid0 = ReadBank(0, bank[0]);
+      bool valid1 = ReadBank(1, bank[1]);
+
+      if (!valid0 && !valid1) {
+         if (!Format()) {
+            storage_ = NULL;
+            return false;
+         }
+         return true;
+      }
+      bank_       = valid1 && (!valid0 || (int32_t) (bank[1].generation - bank[0].generation) > 0);
+      generation_ = bank[bank_].generation;
+      Scan();
+      return true;
+   }
+
+   /* Load a record and check its version and size. */
+   bool Load(const char *key, uint16_t version, void *data, size_t size)
+   {
+      RecordLogEntry *entry = IsOpen() ? Find(key) : NULL;
+
+      if (!entry || entry->version != version || entry->size != size) {
+         return false;
+      }
+      if (entry->pending) {
+         memcpy(data, entry->pending, size);
+         return true;
+      }
+      return ReadData(*entry, data);
+   }
+
+   /* Keep a record for the next Commit(), nothing is written if it is unchanged. */
+   bool Save(const char *key, uint16_t version, const void *data, size_t size)
+   {
+      RecordLogEntry *entry = IsOpen() && size <= 0xffff ? Add(key) : NULL;
+
+      if (!entry) {
+         return false;
+      }
+      RecordLogEntry updated = *entry;
+
+      updated.version = version;
+      updated.size    = size;
+      updated.crc     = RecordCrc(Header(updated), data);
+      if (!entry->pending && entry->offset && 
+          entry->version == version && entry->size == size && entry->crc == updated.crc) {
+         return true;
+      }
+      uint8_t *pending = entry->pending;
+
+      if (!pending || entry->size != size) {
+         pending = (uint8_t *) alloc_->Alloc(size ? size : 1);
+         if (!pending) {
+            return false;
+         }
+         alloc_->Free(entry->pending);
+      }
+      memcpy(pending, data, size);
+      *entry = updated;
+      entry->pending = pending;
+      return true;
+   }
+
+   /* Copy the newest records into the other bank and activate it. */
+   bool Compact()
+   {
+      int           bank    = !bank_;
+      uint32_t      tail    = sizeof(RecordLogBank);
+      uint32_t      offset[RECORD_LOG_ENTRIES];
+      int           written = 0;
+      uint8_t      *data    = NULL;
+      size_t        size    = 0;
+      bool          ret     = storage_->Erase(BankStart(bank), bankSize_);
+      RecordLogBank header;
+
+      for (int i = 0; ret && i < count_; i++) {
+         RecordLogEntry &entry = entries_[i];
+
+         offset[i] = 0;
+         if (!entry.pending) {
+            data = Grow(data, size, entry.size);
+            if (!data) {
+               ret = false;
+               break;
+            }
+            if (!ReadData(entry, data)) {
+               continue; // never committed or damaged, the record is dropped
+            }
+         }
+         ret = tail + RecordSize(entry.size) + RecordSize(0) <= bankSize_ &&
+               WriteRecord(bank, tail, entry, entry.pending ? entry.pending : data);
+         offset[i] = tail + sizeof(RecordLogHeader);
+         tail += RecordSize(entry.size);
+         written++;
+      }
+      alloc_->Free(data);
+      if (!ret || !WriteCommit(bank, tail, written)) {
+         return false;
+      }
+      tail += RecordSize(0);
+      header.magic      = RECORD_LOG_BANK_MAGIC;
+      header.generation = generation_ + 1;
+      header.crc        = BankCrc(header);
+      header.reserved   = 0xffffffff;
+      if (!storage_->Write(BankStart(bank), &header, sizeof(header))) {
+         return false;
+      }
+      for (int i = 0; i < count_; i++) {
+         alloc_->Free(entries_[i].pending);
+         entries_[i].pending = NULL;
+         entries_[i].offset  = offset[i];
+      }
+      bank_       = bank;
+      generation_ = header.generation;
+      tail_       = tail;
+      return true;
+   }
+
+   /* 
+    * Append all saved records and the RECORD_LOG_COMMIT marker, compact if 
+    * they don't fit into the active bank. The entries point to the new 
+    * records once the marker is written.
+    */
+   bool Commit()
+   {
+      uint32_t needed  = RecordSize(0);
+      uint32_t tail    = tail_;
+      int      written = 0;
+
+      if (!IsOpen()) {
+         return false;
+      }
+      for (int i = 0; i < count_; i++) {
+         if (entries_[i].pending) {
+            needed += RecordSize(entries_[i].size);
+         }
+      }
+      if (needed == RecordSize(0)) {
+         return true;
+      }
+      if (tail_ + needed > bankSize_) {
+         return Compact();
+      }
+      for (int i = 0; i < count_; i++) {
+         if (entries_[i].pending) {
+            if (!WriteRecord(bank_, tail, entries_[i], entries_[i].pending)) {
+               tail_ = bankSize_; // compact on the next try
+               return false;
+            }
+            tail += RecordSize(entries_[i].size);
+            written++;
+         }
+      }
+      if (!WriteCommit(bank_, tail, written)) {
+         tail_ = bankSize_;
+         return false;
+      }
+      for (int i = 0; i < count_; i++) {
+         RecordLogEntry &entry = entries_[i];
+
+         if (entry.pending) {
+            alloc_->Free(entry.pending);
+            entry.pending = NULL;
+            entry.offset  = tail_ + sizeof(RecordLogHeader);
+            tail_ += RecordSize(entry.size);
+         }
+      }
+      tail_ += RecordSize(0);
+      return true;
+   }
+};
+
+#ifdef ARDUINO
+#include <esp_partition.h>
+
+#define RECORD_LOG_PARTITION  "records"
+#define RECORD_LOG_SUBTYPE    0x40 // first custom data subtype
+
+/**
+  * RecordLogStorage of the RECORD_LOG_PARTITION flash partition (see partitions.csv).
+  */
+class RecordLogPartition : public RecordLogStorage
+{
+protected:
+   const esp_partition_t *partition_; //!< The partition, NULL if it does not exist
+
+public:
+   RecordLogPartition()
+      : partition_(NULL)
+   {
+   }
+
+   /* Find the partition. */
+   bool Begin()
+   {
+      partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, 
+                                            (esp_partition_subtype_t) RECORD_LOG_SUBTYPE, 
+                                            RECORD_LOG_PARTITION);
+      return partition_ != NULL;
+   }
+
+   uint32_t Size() override
+   {
+      return partition_ ? partition_->size : 0;
+   }
+
+   bool Read(uint32_t offset, void *data, size_t size) override
+   {
+      return esp_partition_read(partition_, offset, data, size) == ESP_OK;
+   }
+
+   bool Write(uint32_t offset, const void *data, size_t size) override
+   {
+      return esp_partition_write(partition_, offset, data, size) == ESP_OK;
+   }
+
+   bool Erase(uint32_t offset, uint32_t size) override
+   {
+      return esp_partition_erase_range(partition_, offset, size) == ESP_OK;
+   }
+};
+
+#else
+#include <stdio.h>
+
+/**
+  * RecordLogStorage in a file of a fixed size for the host tools.
+  * Like the flash, Write() only clears bits of erased bytes.
+  */
+class RecordLogFile : public RecordLogStorage
+{
+protected:
+   FILE     *file_; //!< The open file, NULL on error
+   uint32_t  size_; //!< Size of the storage
+
+public:
+   RecordLogFile(const char *path, uint32_t size)
+      : file_(NULL)
+      , size_(size)
+   {
+      file_ = fopen(path, "r+b");
+      if (!file_) {
+         file_ = fopen(path, "w+b");
+         if (file_ && !Erase(0, size)) {
+            fclose(file_);
+            file_ = NULL;
+         }
+      }
+   }
+
+   ~RecordLogFile()
+   {
+      if (file_) {
+         fclose(file_);
+      }
+   }
+
+   uint32_t Size() override
+   {
+      return file_ ? size_ : 0;
+   }
+
+   bool Read(uint32_t offset, void *data, size_t size) override
+   {
+      return file_ && offset + size <= size_ && 
+             fseek(file_, offset, SEEK_SET) == 0 && fread(data, 1, size, file_) == size;
+   }
+
+   bool Write(uint32_t offset, const void *data, size_t size) override
+   {
+      uint8_t buffer[256];
+
+      for (size_t done = 0; done < size; ) {
+         size_t n = size - done < sizeof(buffer) ? size - done : sizeof(buffer);
+
+         if (!Read(offset + done, buffer, n)) {
+            return false;
+         }
+         for (size_t i = 0; i < n; i++) {
+            buffer[i] &= ((const uint8_t *) data)[done + i];
+         }
+         if (fseek(file_, offset + done, SEEK_SET) != 0 || fwrite(buffer, 1, n, file_) != n) {
+            return false;
+         }
+         done += n;
+      }
+      return fflush(file_) == 0;
+   }
+
+   bool Erase(uint32_t offset, uint32_t size) override
+   {
+      uint8_t erased[RECORD_LOG_SECTOR];
+
+      if (!file_ || offset % RECORD_LOG_SECTOR || size % RECORD_LOG_SECTOR || offset + size > size_) {
+         return false;
+      }
+      memset(erased, 0xff, sizeof(erased));
+      for (uint32_t done = 0; done < size; done += sizeof(erased)) {
+         if (fseek(file_, offset + done, SEEK_SET) != 0 || fwrite(erased, 1, sizeof(erased), file_) != sizeof(erased)) {
+            return false;
+         }
+      }
+      return fflush(file_) == 0;
+   }
+};
+#endif
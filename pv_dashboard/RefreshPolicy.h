@@ -0,0 +1,188 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file RefreshPolicy.h
+  * 
+  * Significance thresholds which decide if a changed value is worth a panel refresh.
+  */
+#pragma once
+#include "Data.h"
+#include "PVRecord.h"
+#include "NVSRecord.h"
+
+#define SHOWN_RECORD_KEY     "shown"
+#define SHOWN_RECORD_VERSION 2
+
+/**
+  * Weather values drawn on the dashboard.
+  */
+enum WeatherField
+{
+   WEATHER_MAX_TEMP, //!< forecastMaxTemp graph
+   WEATHER_MIN_TEMP, //!< forecastMinTemp graph
+   WEATHER_CLOUDS,   //!< forecastClouds graph
+   WEATHER_FIELD_COUNT
+};
+
+/**
+  * A change is significant if it reaches the larger of the absolute and 
+  * the relative threshold, so small values are not redrawn for every 
+  * few watts. Without both thresholds every change is significant.
+  * A smaller change is drawn anyway when the shown value is older than
+  * maxStale seconds (0 for never).
+  */
+struct FieldPolicy
+{
+   float    absolute; //!< Absolute threshold in the unit of the field
+   float    relative; //!< Threshold as fraction of the shown value
+   uint32_t maxStale; //!< Seconds until a smaller change is drawn anyway
+};
+
+#define PV_FIELD_POLICY(field, member, type, key, bytes, scale, unit, absolute, relative, maxStale) { absolute, relative, maxStale },
+
+/* Policy of every PVField, from the PV_SCHEMA. */
+static const FieldPolicy pvFieldPolicy[PV_FIELD_COUNT] = 
+{
+   PV_SCHEMA(PV_FIELD_POLICY)
+};
+
+/* Policy of every WeatherField. */
+static const FieldPolicy weatherFieldPolicy[WEATHER_FIELD_COUNT] = 
+{
+   {   1.0, 0,     6 * 60 * 60 }, // WEATHER_MAX_TEMP    C
+   {   1.0, 0,     6 * 60 * 60 }, // WEATHER_MIN_TEMP    C
+   {  10.0, 0,     6 * 60 * 60 }, // WEATHER_CLOUDS      %
+};
+
+/**
+  * The values on the panel with the time they were drawn.
+  */
+struct ShownRecord
+{
+   float    scalar[PV_SCALAR_COUNT];                    //!< Scalar PVFields
+   uint8_t  fveState;                                   //!< PV_FVE_STATE as FveState
+   float    historyPower[MAX_PV_HISTORY];               //!< PV_HISTORY_POWER
+   float    historyYeld[MAX_PV_HISTORY];                //!< PV_HISTORY_YELD
+   float    weather[WEATHER_FIELD_COUNT][MAX_FORECAST]; //!< WeatherFields
+   uint32_t pvTime[PV_FIELD_COUNT];                     //!< RTC time the PVField was drawn
+   uint32_t weatherTime[WEATHER_FIELD_COUNT];           //!< RTC time the WeatherField was drawn
+};
+
+/* Weather array of the WeatherField. */
+static float *WeatherValues(Weather &weather, int field)
+{
+   switch (field) {
+      case WEATHER_MAX_TEMP: return weather.forecastMaxTemp;
+      case WEATHER_MIN_TEMP: return weather.forecastMinTemp;
+      default:               return weather.forecastClouds;
+   }
+}
+
+/* Check the change of one value against the policy. */
+bool IsSignificant(float shown, float value, const FieldPolicy &policy, uint32_t shownTime, time_t now)
+{
+   float diff = fabs(value - shown);
+
+   if (value == shown) {
+      return false;
+   }
+   if (policy.absolute <= 0 && policy.relative <= 0) {
+      return true;
+   }
+   if (policy.maxStale && now - (time_t) shownTime >= (time_t) policy.maxStale) {
+      return true;
+   }
+   return diff >= fmax(policy.absolute, policy.relative * fabs(shown));
+}
+
+/* Check an array, significant if one of the entries is significant. */
+bool IsSignificant(const float *shown, const float *values, int count, const FieldPolicy &policy, uint32_t shownTime, time_t now)
+{
+   for (int i = 0; i < count; i++) {
+      if (IsSignificant(shown[i], values[i], policy, shownTime, now)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/* Mask of the PVFields with a significant change against the panel. */
+uint32_t SignificantPVFields(const ShownRecord &shown, const Huawei &huawei, time_t now)
+{
+   uint32_t fields = 0;
+
+   for (int field = 0; field < PV_SCALAR_COUNT; field++) {
+      if (IsSignificant(shown.scalar[field], huawei.*pvScalarMember[field], pvFieldPolicy[field], shown.pvTime[field], now)) {
+         fields |= 1UL << field;
+      }
+   }
+   if (shown.fveState != huawei.fve_state) {
+      fields |= 1UL << PV_FVE_STATE;
+   }
+   if (IsSignificant(shown.historyPower, huawei.historyPower, MAX_PV_HISTORY, 
+                     pvFieldPolicy[PV_HISTORY_POWER], shown.pvTime[PV_HISTORY_POWER], now)) {
+      fields |= 1UL << PV_HISTORY_POWER;
+   }
+   if (IsSignificant(shown.historyYeld, huawei.historyYeld, MAX_PV_HISTORY, 
+                     pvFieldPolicy[PV_HISTORY_YELD], shown.pvTime[PV_HISTORY_YELD], now)) {
+      fields |= 1UL << PV_HISTORY_YELD;
+   }
+   return fields;
+}
+
+/* Mask of the WeatherFields with a significant change against the panel. */
+uint32_t SignificantWeatherFields(const ShownRecord &shown, Weather &weather, time_t now)
+{
+   uint32_t fields = 0;
+
+   for (int field = 0; field < WEATHER_FIELD_COUNT; field++) {
+      if (IsSignificant(shown.weather[field], WeatherValues(weather, field), MAX_FORECAST, 
+                        weatherFieldPolicy[field], shown.weatherTime[field], now)) {
+         fields |= 1UL << field;
+      }
+   }
+   return fields;
+}
+
+/* Take over the values of the redrawn fields. */
+void UpdateShown(ShownRecord &shown, const Huawei &huawei, Weather &weather, uint32_t pvFields, bool weatherDrawn, time_t now)
+{
+   for (int field = 0; field < PV_SCALAR_COUNT; field++) {
+      if (pvFields & (1UL << field)) {
+         shown.scalar[field] = huawei.*pvScalarMember[field];
+         shown.pvTime[field] = now;
+      }
+   }
+   if (pvFields & (1UL << PV_FVE_STATE)) {
+      shown.fveState = huawei.fve_state;
+      shown.pvTime[PV_FVE_STATE] = now;
+   }
+   if (pvFields & (1UL << PV_HISTORY_POWER)) {
+      memcpy(shown.historyPower, huawei.historyPower, sizeof(shown.historyPower));
+      shown.pvTime[PV_HISTORY_POWER] = now;
+   }
+   if (pvFields & (1UL << PV_HISTORY_YELD)) {
+      memcpy(shown.historyYeld, huawei.historyYeld, sizeof(shown.historyYeld));
+      shown.pvTime[PV_HISTORY_YELD] = now;
+   }
+   if (weatherDrawn) {
+      for (int field = 0; field < WEATHER_FIELD_COUNT; field++) {
+         memcpy(shown.weather[field], WeatherValues(weather, field), sizeof(shown.weather[field]));
+         shown.weatherTime[field] = now;
+      }
+   }
+}
@@ -0,0 +1,178 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file Scheduler.h
+  * 
+  * Chooses the next wake time from the sun and the power changes.
+  */
+#pragma once
+#include "Data.h"
+#include "Display.h"
+#include "EPD.h"
+#include "NVSRecord.h"
+#include "WarmWake.h"
+
+#define SCHEDULE_RECORD_KEY     "schedule"
+#define SCHEDULE_RECORD_VERSION 2
+#define MAX_TIMER_SLEEP         (255 * 60) // longest countdown of the RTC timer
+
+/**
+  * Values of the previous wake for the rate of change.
+  */
+struct ScheduleRecord
+{
+   uint32_t wakeTime;   //!< RTC time of the previous online wake
+   float    panelPower; //!< panelPower of the previous online wake
+   float    gridPower;  //!< grid_power of the previous online wake
+   uint16_t failures;   //!< Failed connections since the previous online wake
+};
+
+/**
+  * Result of the wake scheduler.
+  */
+struct WakeSchedule
+{
+   time_t wakeTime; //!< RTC time of the next wake
+   bool   night;    //!< The device sleeps through the night
+   bool   warm;     //!< Deep sleep instead of the shutdown
+};
+
+/* Next RTC time with the time of day of the timestamp. */
+time_t NextTimeOfDay(time_t now, time_t timestamp)
+{
+   time_t next = now - now % SECS_PER_DAY + timestamp % SECS_PER_DAY;
+
+   return next > now ? next : next + SECS_PER_DAY;
+}
+
+/* Wake interval from the power change since the previous wake. */
+long VolatilityInterval(const Huawei &huawei, const ScheduleRecord &last, time_t now)
+{
+   if (last.wakeTime == 0 || now <= (time_t) last.wakeTime) {
+      return WAKE_INTERVAL;
+   }
+   double minutes = (now - last.wakeTime) / 60.0;
+   double change  = max(fabs(huawei.panelPower - last.panelPower),
+                        fabs(huawei.grid_power - last.gridPower)) * 10.0 / max(minutes, 1.0);
+
+   if (change >= VOLATILE_POWER) {
+      return WAKE_INTERVAL_MIN;
+   } else if (change < STEADY_POWER) {
+      return WAKE_INTERVAL_MAX;
+   }
+   return WAKE_INTERVAL;
+}
+
+/* Wake interval without a connection, WAKE_INTERVAL doubled with every further failure. */
+long OfflineInterval(const ScheduleRecord &last)
+{
+   long backoff = WAKE_INTERVAL;
+
+   for (int i = 0; i < last.failures && backoff < OFFLINE_MAX_INTERVAL; i++) {
+      backoff *= 2;
+   }
+   return min(backoff, (long) OFFLINE_MAX_INTERVAL);
+}
+
+/* 
+ * Choose the next wake.
+ * Between sunrise and sunset (widened by NIGHT_MARGIN) the interval follows the
+ * change of panelPower and grid_power per 10 minutes. The night is skipped, 
+ * optionally after one end-of-day summary wake at sunset.
+ * Without a connection the interval starts at WAKE_INTERVAL and doubles with
+ * every further failure up to OFFLINE_MAX_INTERVAL, the power change of the 
+ * cached values is not used. myData.staleSince is set to the last online wake.
+ * A day wake is pulled forward to the due full refresh of the panel 
+ * (FULL_REFRESH_INTERVAL after DisplayState.lastFullRefresh), so the
+ * ghosting is removed on time and not by the next wake after it.
+ */
+WakeSchedule GetWakeSchedule(MyData &myData, bool online = true)
+{
+   WakeSchedule   schedule;
+   ScheduleRecord last;
+   DisplayState   display;
+   time_t         now     = GetRTCTime();
+   Weather       &weather = myData.weather;
+
+   if (!LoadNVSRecord(SCHEDULE_RECORD_KEY, SCHEDULE_RECORD_VERSION, &last, sizeof(last))) {
+      memset(&last, 0, sizeof(last));
+   }
+   schedule.night    = false;
+   schedule.wakeTime = now + (online ? VolatilityInterval(myData.huawei, last, now) : OfflineInterval(last));
+
+   if (weather.sunrise != 0 && weather.sunset != 0) {
+      time_t dayStart  = weather.sunrise - NIGHT_MARGIN;
+      time_t dayEnd    = weather.sunset  + NIGHT_MARGIN;
+      time_t daySecond = now % SECS_PER_DAY;
+      time_t nextStart = NextTimeOfDay(now, dayStart);
+
+      if (daySecond < dayStart % SECS_PER_DAY || daySecond >= dayEnd % SECS_PER_DAY) {
+         schedule.night    = true;
+         schedule.wakeTime = nextStart;
+      } else if (schedule.wakeTime - now + daySecond >= dayEnd % SECS_PER_DAY) {
+         if (NIGHT_SUMMARY) {
+            schedule.wakeTime = NextTimeOfDay(now, dayEnd);
+         } else {
+            schedule.night    = true;
+            schedule.wakeTime = nextStart;
+         }
+      }
+   }
+   if (!schedule.night && LoadNVSRecord(DISPLAY_RECORD_KEY, DISPLAY_RECORD_VERSION, &display, sizeof(display)) &&
+       display.lastFullRefresh != 0) {
+      time_t fullRefresh = (time_t) display.lastFullRefresh + FULL_REFRESH_INTERVAL;
+
+      if (fullRefresh > now && fullRefresh < schedule.wakeTime) {
+         schedule.wakeTime = fullRefresh;
+      }
+   }
+
+   if (online) {
+      last.wakeTime   = now;
+      last.panelPower = myData.huawei.panelPower;
+      last.gridPower  = myData.huawei.grid_power;
+      last.failures   = 0;
+   } else {
+      last.failures++;
+      myData.staleSince = last.wakeTime ? last.wakeTime : now;
+   }
+   SaveNVSRecord(SCHEDULE_RECORD_KEY, SCHEDULE_RECORD_VERSION, &last, sizeof(last));
+   schedule.warm = SelectWakeMode(myData.batteryVolt, schedule.wakeTime - now > MAX_TIMER_SLEEP) == WAKE_WARM;
+
+   Serial.println("Next wake: " + getDateTimeString(schedule.wakeTime) + (schedule.night ? " (night)" : ""));
+   return schedule;
+}
+
+/* Write the saved records, release the wakeArena and shutdown until the scheduled wake time. */
+void ShutdownScheduled(const WakeSchedule &schedule)
+{
+   CommitNVSRecords();
+   wakeArena.Reset();
+
+   long seconds = schedule.wakeTime - GetRTCTime();
+
+   if (seconds < WAKE_INTERVAL_MIN) {
+      seconds = WAKE_INTERVAL_MIN;
+   }
+   if (schedule.warm) {
+      SleepEPD(seconds);
+   } else if (seconds <= MAX_TIMER_SLEEP) {
+      ShutdownEPD(seconds);
+   } else {
+      ShutdownEPDUntil(schedule.wakeTime);
+   }
+}
@@ -0,0 +1,108 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file UDPData.h
+  * 
+  * Alternative PV data source: one UDP request (or a multicast beacon) to a local gateway.
+  */
+#pragma once
+#include <WiFiUdp.h>
+#include "PVDatagram.h"
+#include "getJsonData.h"
+
+/* 
+ * Read the PV snapshot (and optionally the weather) from the UDP gateway.
+ * Sends one PG_REQUEST with the last applied sequence number and epoch and
+ * waits UDP_TIMEOUT ms for the answer, or with UDP_MULTICAST for the next 
+ * beacon. The cached snapshot is only a delta base within the same epoch.
+ * A weather datagram following the PV datagram replaces the weather request
+ * of this wake (see Weather::SetRecord).
+ */
+bool GetUDPValues(MyData &myData)
+{
+   WiFiUDP       udp;
+   uint8_t       buf[PG_MAX_DATAGRAM];
+   PVCacheRecord cache;
+   bool          pvDone   = false;
+   unsigned long pvTime   = 0;
+   bool          weather  = false;
+
+   if (LoadNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache))) {
+      myData.huawei.FromSnapshot(cache.pv);
+      myData.pvChanged = 0;
+   } else {
+      cache.seq        = 0;
+      cache.epoch      = 0;
+      myData.pvChanged = PV_ALL_FIELDS;
+   }
+
+#ifdef UDP_MULTICAST
+   IPAddress group;
+
+   group.fromString(UDP_MULTICAST);
+   udp.beginMulticast(group, UDP_PORT);
+#else
+   size_t len = PGEncode(buf, sizeof(buf), PG_REQUEST, cache.seq, cache.epoch, NULL, 0);
+
+   udp.begin(UDP_PORT);
+   udp.beginPacket(UDP_GATEWAY, UDP_GATEWAY_PORT);
+   udp.write(buf, len);
+   udp.endPacket();
+#endif
+
+   for (unsigned long start = millis(); millis() - start < UDP_TIMEOUT && !wakeBudget.Expired(); ) {
+      if (pvDone && (weather || millis() - pvTime > UDP_WEATHER_WAIT)) {
+         break;
+      }
+      int size = udp.parsePacket();
+
+      if (size <= 0) {
+         delay(1);
+         continue;
+      }
+      PGHeader header;
+
+      size = udp.read(buf, sizeof(buf));
+      if (!PGDecode(buf, size, header)) {
+         Serial.println("UDP datagram invalid");
+         continue;
+      }
+      if (header.type == PG_PV && !pvDone) {
+         bool     sameEpoch = header.epoch == cache.epoch;
+         uint32_t seq       = sameEpoch ? cache.seq : 0; // another epoch: only a full snapshot applies
+
+         if ((!sameEpoch || header.seq != cache.seq) && ApplyPVRecord(buf + PG_HEADER, header.length, seq, myData.huawei) < 0) {
+            continue;
+         }
+         myData.pvChanged |= myData.huawei.Diff(cache.pv);
+         if (!sameEpoch || seq != cache.seq) {
+            SaveCachedPVValues(myData.huawei, seq, header.epoch);
+         }
+         pvDone = true;
+         pvTime = millis();
+      } else if (header.type == PG_WEATHER && header.length == sizeof(WeatherRecord)) {
+         WeatherRecord record;
+
+         memcpy(&record, buf + PG_HEADER, sizeof(record));
+         myData.weather.SetRecord(record);
+         weather = true;
+      }
+   }
+   udp.stop();
+   Serial.printf("UDP gateway: %s%s\n", pvDone ? "ok" : "no answer", weather ? ", weather" : "");
+   return pvDone;
+}
@@ -0,0 +1,131 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file WakeArena.h
+  * 
+  * Bump allocator for the transient buffers of one wake.
+  */
+#pragma once
+
+#define WAKE_ARENA_ALIGN 8
+
+/**
+  * One block, in the PSRAM if available, is allocated at the first use.
+  * Alloc() bumps the offset, Free() only returns the newest allocation,
+  * everything else is released in one step by Reset() at the end of the
+  * wake, so the heap does not fragment with the payload sizes. If the 
+  * arena is full the heap is used and the miss is counted. The peak of 
+  * every WakePhase is reported by WakeBudget.
+  */
+class WakeArena
+{
+protected:
+   uint8_t *base_;     //!< The block, NULL if not allocated
+   size_t   size_;     //!< Size of the block
+   size_t   used_;     //!< Bump offset
+   size_t   last_;     //!< Offset of the newest allocation
+   size_t   peak_;     //!< Highest used_ since TakePeak()
+   size_t   wakePeak_; //!< Highest used_ of the wake
+   uint32_t misses_;   //!< Allocations which went to the heap
+   bool     tried_;    //!< The block was requested
+
+protected:
+   /* Allocate the block once. */
+   bool Begin()
+   {
+      if (!tried_) {
+         tried_ = true;
+         base_  = (uint8_t *) ps_malloc(WAKE_ARENA_SIZE);
+         if (!base_) {
+            base_ = (uint8_t *) malloc(WAKE_ARENA_SIZE);
+         }
+         if (base_) {
+            size_ = WAKE_ARENA_SIZE;
+         } else {
+            Serial.println("Arena: out of memory");
+         }
+      }
+      return base_ != NULL;
+   }
+
+public:
+   WakeArena()
+      : base_(NULL)
+      , size_(0)
+      , used_(0)
+      , last_(0)
+      , peak_(0)
+      , wakePeak_(0)
+      , misses_(0)
+      , tried_(false)
+   {
+   }
+
+   /* Memory of the arena or of the heap if it does not fit. */
+   void *Alloc(size_t size)
+   {
+      size_t start = (used_ + WAKE_ARENA_ALIGN - 1) & ~(WAKE_ARENA_ALIGN - 1);
+
+      if (!Begin() || start + size > size_) {
+         misses_++;
+         return malloc(size);
+      }
+      last_     = start;
+      used_     = start + size;
+      peak_     = max(peak_, used_);
+      wakePeak_ = max(wakePeak_, used_);
+      return base_ + start;
+   }
+
+   /* Give back the newest allocation of the arena or free a heap block. */
+   void Free(void *data)
+   {
+      if (!Owns(data)) {
+         free(data);
+      } else if ((uint8_t *) data == base_ + last_) {
+         used_ = last_;
+      }
+   }
+
+   /* The memory belongs to the arena. */
+   bool Owns(const void *data)
+   {
+      return base_ && (const uint8_t *) data >= base_ && (const uint8_t *) data < base_ + size_;
+   }
+
+   /* Peak since the previous call, starts the next measurement. */
+   size_t TakePeak()
+   {
+      size_t peak = peak_;
+
+      peak_ = used_;
+      return peak;
+   }
+
+   /* Release everything at the end of the wake. */
+   void Reset()
+   {
+      Serial.printf("Arena: peak %u of %u bytes, %u heap misses\n", wakePeak_, size_, misses_);
+      used_     = 0;
+      last_     = 0;
+      peak_     = 0;
+      wakePeak_ = 0;
+      misses_   = 0;
+   }
+};
+
+WakeArena wakeArena; // The transient buffers of this wake
@@ -0,0 +1,185 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file WakeBudget.h
+  * 
+  * Time budget of one wake with a slice for every phase.
+  */
+#pragma once
+#include "NVSRecord.h"
+#include "WakeArena.h"
+
+#define BUDGET_RECORD_KEY     "budget"
+#define BUDGET_RECORD_VERSION 1
+
+/**
+  * Phases of one wake in the order of setup().
+  */
+enum WakePhase
+{
+   PHASE_WIFI,
+   PHASE_NTP,
+   PHASE_PV,
+   PHASE_WEATHER,
+   PHASE_RENDER,
+   PHASE_COUNT
+};
+
+static const char *wakePhaseName[PHASE_COUNT] = { "wifi", "ntp", "pv", "weather", "render" };
+
+/** 
+  * Time slice of every phase in ms.
+  */
+static const uint32_t wakePhaseSlice[PHASE_COUNT] = 
+{
+   BUDGET_WIFI,
+   BUDGET_NTP,
+   BUDGET_PV,
+   BUDGET_WEATHER,
+   BUDGET_RENDER,
+};
+
+/**
+  * Overrun statistics per phase, kept in the NVS.
+  */
+struct BudgetRecord
+{
+   uint16_t overruns[PHASE_COUNT]; //!< Number of overruns
+   uint16_t lastMs[PHASE_COUNT];   //!< Duration of the last overrun
+   uint16_t worstMs[PHASE_COUNT];  //!< Longest overrun
+};
+
+/**
+  * Every phase is started with Start() and polls Expired() or passes 
+  * Remaining() as timeout to the blocking calls. A phase that runs out of
+  * time gives up and leaves the last good data for the display.
+  */
+class WakeBudget
+{
+protected:
+   unsigned long wakeStart;  //!< millis() at the start of the wake
+   unsigned long phaseStart; //!< millis() at the start of the phase
+   unsigned long deadline;   //!< millis() at the end of the phase
+   int           phase;      //!< Running phase or -1
+   BudgetRecord  record;     //!< Overrun statistics
+   bool          loaded;     //!< record is read from the NVS
+   bool          overrun;    //!< Any phase of this wake overran
+   bool          cancelled;  //!< The running phase saw Expired() and gave up
+
+protected:
+   /* Close the running phase and count an overrun of the deadline it was given. */
+   void End()
+   {
+      if (phase < 0) {
+         return;
+      }
+      uint32_t used  = millis() - phaseStart;
+      uint32_t given = deadline - phaseStart;
+      size_t   peak  = wakeArena.TakePeak();
+
+      if (used > given) {
+         uint16_t ms = min(used, (uint32_t) 0xffff);
+
+         if (!loaded) {
+            if (!LoadNVSRecord(BUDGET_RECORD_KEY, BUDGET_RECORD_VERSION, &record, sizeof(record))) {
+               memset(&record, 0, sizeof(record));
+            }
+            loaded = true;
+         }
+         record.overruns[phase]++;
+         record.lastMs[phase]  = ms;
+         record.worstMs[phase] = max(record.worstMs[phase], ms);
+         overrun = true;
+         Serial.printf("Budget: %s overrun %u/%u ms%s, arena %u bytes\n", wakePhaseName[phase], used, given, cancelled ? ", cancelled" : "", peak);
+      } else {
+         Serial.printf("Budget: %s %u/%u ms%s, arena %u bytes\n", wakePhaseName[phase], used, given, cancelled ? ", cancelled" : "", peak);
+      }
+      phase = -1;
+   }
+
+public:
+   WakeBudget()
+      : wakeStart(millis())
+      , phaseStart(0)
+      , deadline(0)
+      , phase(-1)
+      , loaded(false)
+      , overrun(false)
+      , cancelled(false)
+   {
+      memset(&record, 0, sizeof(record));
+   }
+
+   /* Start the next phase, limited by the rest of the WAKE_BUDGET. */
+   void Start(WakePhase next)
+   {
+      End();
+      wakeArena.TakePeak();
+      phase      = next;
+      phaseStart = millis();
+      cancelled  = false;
+      deadline   = phaseStart + wakePhaseSlice[next];
+      if ((long) (deadline - (wakeStart + WAKE_BUDGET)) > 0) {
+         deadline = wakeStart + WAKE_BUDGET;
+      }
+   }
+
+   /* ms left in the running phase. */
+   uint32_t Remaining()
+   {
+      long left = (long) (deadline - millis());
+
+      return left > 0 ? left : 0;
+   }
+
+   /* Remaining() clamped to the 16 bit timeouts of HTTPClient. */
+   uint16_t Timeout()
+   {
+      return max((uint32_t) 1, min(Remaining(), (uint32_t) 0xffff));
+   }
+
+   /* The running phase has to give up. */
+   bool Expired()
+   {
+      if (Remaining() == 0) {
+         cancelled = true;
+      }
+      return cancelled;
+   }
+
+   /* millis() at the end of the running phase. */
+   unsigned long Deadline()
+   {
+      return deadline;
+   }
+
+   /* Close the last phase and store the statistics if a phase overran. */
+   void Finish()
+   {
+      End();
+      Serial.printf("Budget: wake %lu ms\n", millis() - wakeStart);
+      if (overrun) {
+         for (int i = 0; i < PHASE_COUNT; i++) {
+            Serial.printf("Budget: %-7s %u overruns, last %u ms, worst %u ms\n", 
+               wakePhaseName[i], record.overruns[i], record.lastMs[i], record.worstMs[i]);
+         }
+         SaveNVSRecord(BUDGET_RECORD_KEY, BUDGET_RECORD_VERSION, &record, sizeof(record));
+      }
+   }
+};
+
+WakeBudget wakeBudget; // The budget of this wake
@@ -0,0 +1,152 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file WarmWake.h
+  * 
+  * Warm wakes from the deep sleep with the state of the previous wake.
+  *
+  * M5.shutdown() cuts the power, every wake is a cold boot which rebuilds 
+  * all state from the flash and scans for the wifi. In the deep sleep the 
+  * main power stays on and the RTC slow memory survives: the records (see 
+  * RTCRecord.h), the access point of the wifi and the time of the last NTP
+  * sync. The deep sleep itself draws more current, so with WAKE_MODE 2 
+  * both modes are measured by the battery drop between the wakes and the 
+  * cheaper one is used.
+  */
+#pragma once
+#include "NVSRecord.h"
+
+#define WAKE_COLD 0 // M5.shutdown(), wake by the RTC
+#define WAKE_WARM 1 // deep sleep, wake by the ESP32 timer
+#define WAKE_AUTO 2 // the mode with the lower measured battery drop
+
+#define WARM_STATE_MAGIC         0x4d524157 // "WARM"
+#define WARM_WIFI_TIMEOUT        3000       // ms to connect to the known access point
+#define WAKE_COST_RECORD_KEY     "wakecost"
+#define WAKE_COST_RECORD_VERSION 2
+#define WAKE_COST_PROBE          ( 6 * 60 * 60)     // seconds to measure a mode before the comparison
+#define WAKE_COST_WINDOW         (7 * 24 * 60 * 60) // seconds after which the other mode is measured again
+#define WAKE_CHARGE_MV           50                 // voltage rise within one cycle that only the charger explains
+
+/**
+  * State of the previous wake in the RTC slow memory.
+  */
+struct WarmState
+{
+   uint32_t magic;    //!< WARM_STATE_MAGIC if the state is valid
+   uint32_t wakes;    //!< Warm wakes since the last cold boot
+   uint32_t ntpTime;  //!< RTC time of the last NTP sync, 0 for none
+   int32_t  channel;  //!< Wifi channel of the access point, 0 for unknown
+   uint8_t  bssid[6]; //!< MAC of the access point
+};
+
+/**
+  * Battery drop of both modes, kept in the flash.
+  */
+struct WakeCostRecord
+{
+   uint32_t seconds[2]; //!< Measured seconds per mode
+   int32_t  dropMv[2];  //!< Signed battery drop in mV within these seconds
+   uint32_t lastTime;   //!< RTC time at the end of the previous wake, 0 for not measured
+   uint16_t lastMv;     //!< Battery voltage of the previous wake
+   uint8_t  lastMode;   //!< Mode of the previous sleep
+};
+
+RTC_DATA_ATTR WarmState warmState; // survives the deep sleep
+bool                    warmWake;  // this wake continues a deep sleep
+
+/* Detect a warm wake and release the main power hold of the deep sleep. */
+bool BeginWarmWake()
+{
+   gpio_hold_dis((gpio_num_t) M5EPD_MAIN_PWR_PIN);
+   warmWake = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER && warmState.magic == WARM_STATE_MAGIC;
+   if (warmWake) {
+      warmState.wakes++;
+      Serial.printf("Warm wake %u\n", warmState.wakes);
+   } else {
+      memset(&warmState, 0, sizeof(warmState));
+      warmState.magic = WARM_STATE_MAGIC;
+      ClearRTCRecords();
+      Serial.println("Cold boot");
+   }
+   return warmWake;
+}
+
+/* Battery drop of a mode in mV per hour, NAN while it is not measured long enough. */
+float WakeCost(const WakeCostRecord &record, int mode)
+{
+   if (record.seconds[mode] < WAKE_COST_PROBE) {
+      return NAN;
+   }
+   return record.dropMv[mode] * 3600.0 / record.seconds[mode];
+}
+
+/* 
+ * Account the time since the previous wake to the mode of its sleep and 
+ * choose the mode of the next sleep. The voltage deltas are summed with 
+ * their sign, so the ADC noise cancels out over the probe window. Long 
+ * sleeps (the night) are always cold and neither they nor the cycles 
+ * with a rise of WAKE_CHARGE_MV (the charger) are measured.
+ */
+int SelectWakeMode(float batteryVolt, bool longSleep)
+{
+   WakeCostRecord record;
+   time_t         now  = GetRTCTime();
+   uint16_t       mv   = lround(batteryVolt * 1000);
+   int            mode = WAKE_MODE;
+
+   if (!LoadNVSRecord(WAKE_COST_RECORD_KEY, WAKE_COST_RECORD_VERSION, &record, sizeof(record))) {
+      memset(&record, 0, sizeof(record));
+   }
+   long cycle = now - record.lastTime;
+   int  drop  = (int) record.lastMv - mv;
+
+   if (record.lastTime && cycle > 0 && cycle <= 2 * WAKE_INTERVAL_MAX && drop > -WAKE_CHARGE_MV && record.lastMode <= WAKE_WARM) {
+      int last = record.lastMode;
+
+      record.seconds[last] += cycle;
+      record.dropMv[last]  += drop;
+      if (record.seconds[last] > WAKE_COST_WINDOW) {
+         record.seconds[last] /= 2;
+         record.dropMv[last]  /= 2;
+         record.seconds[!last] = 0;
+         record.dropMv[!last]  = 0;
+      }
+   }
+   float cold = WakeCost(record, WAKE_COLD);
+   float warm = WakeCost(record, WAKE_WARM);
+
+   if (mode == WAKE_AUTO) {
+      if (isnan(cold)) {
+         mode = WAKE_COLD;
+      } else if (isnan(warm)) {
+         mode = WAKE_WARM;
+      } else {
+         mode = warm < cold ? WAKE_WARM : WAKE_COLD;
+      }
+   }
+   if (longSleep) {
+      mode = WAKE_COLD;
+   }
+   record.lastTime = longSleep ? 0 : now;
+   record.lastMv   = mv;
+   record.lastMode = mode;
+   SaveNVSRecord(WAKE_COST_RECORD_KEY, WAKE_COST_RECORD_VERSION, &record, sizeof(record));
+
+   Serial.printf("Wake mode: %s, cost cold %.1f warm %.1f mV/h\n", mode == WAKE_WARM ? "warm" : "cold", cold, warm);
+   return mode;
+}
@@ -0,0 +1,124 @@
+/*
+   Copyright (C) 2021 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file WeatherJson.h
+  * 
+  * The onecall json of openweathermap parsed into a WeatherRecord.
+  *
+  * Shared with gateway/pv_gateway.cpp, which sends the record as PG_WEATHER.
+  */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "JsonStream.h"
+#include "WeatherRecord.h"
+
+#define MIN_RAIN     10
+
+/**
+  * Writes the used onecall values straight into the fixed point weather record.
+  * The times stay in UTC until Finish().
+  */
+class WeatherJsonHandler : public JsonHandler
+{
+public:
+   WeatherRecord &record;   //!< Target of the values
+   bool           forecast; //!< Take over the hourly and daily forecast
+
+protected:
+   /* Take over the condition id, the night flag comes with the icon. */
+   void SetCondition(uint8_t &code, const char *text)
+   {
+      code = (code & CONDITION_NIGHT) | WeatherConditionFromId(atoi(text));
+   }
+
+   /* Take over the night flag of an icon name like "04n". */
+   void SetNight(uint8_t &code, const char *text)
+   {
+      code = (code & ~CONDITION_NIGHT) | (strlen(text) > 2 && text[2] == 'n' ? CONDITION_NIGHT : 0);
+   }
+
+public:
+   WeatherJsonHandler(WeatherRecord &target, bool withForecast)
+      : record(target)
+      , forecast(withForecast)
+   {
+   }
+
+   void Value(const JsonPath &path, const char *text, bool) override
+   {
+      int  i     = path.depth > 0 ? path.index[0] : 0;               // hourly, daily or weather index
+      int  hour  = i + 1;                                             // hourly[0] follows the current conditions
+      bool first = path.depth < 2 || path.index[path.depth - 1] == 0; // weather[0]
+
+      switch (path.hash) {
+         case JsonHash("timezone_offset"):      record.currentTimeOffset = atol(text);              break;
+         case JsonHash("current.dt"):           record.currentTime       = atol(text);              break;
+         case JsonHash("current.sunrise"):      record.sunrise           = atol(text);              break;
+         case JsonHash("current.sunset"):       record.sunset            = atol(text);              break;
+         case JsonHash("current.temp"):         record.hourlyMaxTemp[0]  = JsonFixed(text, 100);    break;
+         case JsonHash("current.wind_deg"):     record.winddir           = JsonFixed(text, 1);      break;
+         case JsonHash("current.wind_speed"):   record.windspeed         = JsonFixed(text, 100);    break;
+         case JsonHash("current.weather.id"):   if (i == 0) SetCondition(record.hourlyCondition[0], text); break;
+         case JsonHash("current.weather.icon"): if (i == 0) SetNight(record.hourlyCondition[0], text);     break;
+      }
+      if (!forecast) {
+         return;
+      }
+      if (path.depth >= 1 && hour < MAX_HOURLY) {
+         switch (path.hash) {
+            case JsonHash("hourly.dt"):           record.hourlyTime[hour]    = atol(text);           break;
+            case JsonHash("hourly.temp"):         record.hourlyMaxTemp[hour] = JsonFixed(text, 100); break;
+            case JsonHash("hourly.weather.id"):   if (first) SetCondition(record.hourlyCondition[hour], text); break;
+            case JsonHash("hourly.weather.icon"): if (first) SetNight(record.hourlyCondition[hour], text);     break;
+         }
+      }
+      if (path.depth == 1 && i < MAX_FORECAST) {
+         switch (path.hash) {
+            case JsonHash("daily.temp.max"): record.forecastMaxTemp[i]  = JsonFixed(text, 100); break;
+            case JsonHash("daily.temp.min"): record.forecastMinTemp[i]  = JsonFixed(text, 100); break;
+            case JsonHash("daily.rain"):     record.forecastRain[i]     = JsonFixed(text, 10);  break;
+            case JsonHash("daily.humidity"): record.forecastHumidity[i] = JsonFixed(text, 1);   break;
+            case JsonHash("daily.clouds"):   record.forecastClouds[i]   = JsonFixed(text, 1);   break;
+            case JsonHash("daily.pressure"): record.forecastPressure[i] = JsonFixed(text, 1);   break;
+         }
+      }
+   }
+
+   /* Convert the received times to local time and update the rain scale. */
+   void Finish()
+   {
+      int32_t offset = record.currentTimeOffset;
+
+      record.currentTime   += offset;
+      record.sunrise       += offset;
+      record.sunset        += offset;
+      record.hourlyTime[0]  = record.currentTime;
+      if (forecast) {
+         record.maxRain = MIN_RAIN;
+         for (int i = 1; i < MAX_HOURLY; i++) {
+            if (record.hourlyTime[i]) {
+               record.hourlyTime[i] += offset;
+            }
+         }
+         for (int i = 0; i < MAX_FORECAST; i++) {
+            record.maxRain = record.forecastRain[i] / 10 > record.maxRain ? record.forecastRain[i] / 10 : record.maxRain;
+         }
+      }
+   }
+};
@@ -0,0 +1,94 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file WeatherRecord.h
+  * 
+  * Binary weather record for the cache and the PG_WEATHER datagram of the 
+  * UDP gateway. The gateway uses the same layout.
+  */
+#pragma once
+#include <stdint.h>
+
+#define MAX_HOURLY   24
+#define MAX_FORECAST  8
+
+#define CONDITION_NIGHT 0x80 // flag of a WeatherCondition code, night icon
+
+/**
+  * Weather condition groups of the openweathermap condition ids.
+  */
+enum WeatherCondition
+{
+   CONDITION_UNKNOWN,
+   CONDITION_THUNDERSTORM,     //!< 2xx
+   CONDITION_DRIZZLE,          //!< 3xx
+   CONDITION_RAIN,             //!< 500-504
+   CONDITION_FREEZING_RAIN,    //!< 511
+   CONDITION_SHOWER_RAIN,      //!< 520-531
+   CONDITION_SNOW,             //!< 6xx
+   CONDITION_ATMOSPHERE,       //!< 7xx mist, fog, haze, ...
+   CONDITION_CLEAR,            //!< 800
+   CONDITION_FEW_CLOUDS,       //!< 801
+   CONDITION_SCATTERED_CLOUDS, //!< 802
+   CONDITION_BROKEN_CLOUDS,    //!< 803, 804
+   CONDITION_COUNT
+};
+
+/* WeatherCondition of an openweathermap condition id. */
+uint8_t WeatherConditionFromId(int id)
+{
+   switch (id / 100) {
+      case 2: return CONDITION_THUNDERSTORM;
+      case 3: return CONDITION_DRIZZLE;
+      case 5: return id == 511 ? CONDITION_FREEZING_RAIN : (id >= 520 ? CONDITION_SHOWER_RAIN : CONDITION_RAIN);
+      case 6: return CONDITION_SNOW;
+      case 7: return CONDITION_ATMOSPHERE;
+      case 8: return id == 800 ? CONDITION_CLEAR : (id == 801 ? CONDITION_FEW_CLOUDS : 
+                     (id == 802 ? CONDITION_SCATTERED_CLOUDS : CONDITION_BROKEN_CLOUDS));
+   }
+   return CONDITION_UNKNOWN;
+}
+
+/**
+  * Compact binary copy of the weather data for the non volatile cache.
+  * Temperatures are stored in 1/100 C, rain in 1/10 mm.
+  */
+struct WeatherRecord
+{
+   uint32_t fetchTime;                        //!< RTC time of the last full onecall request
+   uint32_t currentFetchTime;                 //!< RTC time of the last current conditions request
+   uint32_t forecastHash;                     //!< CRC32 of the last applied onecall body
+   uint32_t currentHash;                      //!< CRC32 of the last applied current conditions body
+   int32_t  currentTime;                      //!< Current timestamp
+   int32_t  currentTimeOffset;                //!< Current timezone
+   int32_t  sunrise;                          //!< Sunrise timestamp
+   int32_t  sunset;                           //!< Sunset timestamp
+   int16_t  winddir;                          //!< Wind direction in degree
+   int16_t  windspeed;                        //!< Wind speed in 1/100 m/s
+   int16_t  maxRain;                          //!< maximum rain in mm of the day forecast
+
+   int32_t  hourlyTime[MAX_HOURLY];           //!< timestamp of the hourly forecast
+   int16_t  hourlyMaxTemp[MAX_HOURLY];        //!< max temperature forecast
+   uint8_t  hourlyCondition[MAX_HOURLY];      //!< WeatherCondition code of the hourly forecast
+
+   int16_t  forecastMaxTemp[MAX_FORECAST];    //!< max temperature
+   int16_t  forecastMinTemp[MAX_FORECAST];    //!< min temperature
+   int16_t  forecastRain[MAX_FORECAST];       //!< max rain
+   uint8_t  forecastHumidity[MAX_FORECAST];   //!< humidity in %
+   uint8_t  forecastClouds[MAX_FORECAST];     //!< clouds in %
+   uint16_t forecastPressure[MAX_FORECAST];   //!< air pressure in hPa
+};
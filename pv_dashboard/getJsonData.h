@@ -21,7 +21,27 @@
   */
 #pragma once
 
-#include <ArduinoJson.h>
+#include "NVSRecord.h"
+#include "PVRecord.h"
+#include "InflateStream.h"
+#include "JsonStream.h"
+#include "WakeBudget.h"
+
+#define PV_RECORD_KEY     "pv"
+#define PV_RECORD_VERSION 6
+
+/**
+  * Last PV snapshot with the cache validators of its http response.
+  */
+struct PVCacheRecord
+{
+   char     etag[64];         //!< ETag header of the last response
+   char     lastModified[40]; //!< Last-Modified header of the last response
+   uint32_t seq;              //!< Sequence number of the last applied binary record
+   uint32_t epoch;            //!< Epoch of the UDP gateway of seq, 0 for the http server
+   uint32_t bodyHash;         //!< CRC32 of the last applied response body
+   PVSnapshot pv;             //!< The parsed data of the last response
+};
 
 
 /* ***************************************************************************** */
@@ -35,90 +55,281 @@
 // ,"shelly_huawei_power":187,"power_history":[14.733799999998,18.210399999996,13.007399999999,11.664699999998,11.074999999997,13.0514,9.5926999999974,3.8765999999996]
 // ,"yeld_history":[3.03,11.97,2.24,1.29,3.05,3.17,1.5,0.12],"water":100,"gas":1,"power":4,"temp":20.3}
 
-void GetHTTPValues(MyData &myData)
+static_assert(MAX_PV_HISTORY == MAX_FORECAST, "PV record history size");
+
+/* Copy the decoded record fields into the huawei data. */
+void ApplyPVValues(const PVValues &values, Huawei &huawei)
 {
-String payload;
-HTTPClient http;
-  
-  http.begin(URL);
-  int httpCode = http.GET();
-  // httpCode will be negative on error
-    if (httpCode > 0) {
-      // HTTP header has been send and Server response header has been handled
-      Serial.print("[HTTP] GET... code:");
-      Serial.println(httpCode);
-
-      // file found at server
-      if (httpCode == HTTP_CODE_OK) {
-        payload = http.getString();
+  for (int field = 0; field < PV_FIELD_COUNT; field++) {
+    if (!(values.mask & (1UL << field))) {
+      continue;
+    }
+    switch (pvSchema[field].type) {
+      case PV_TYPE_NUMBER:  huawei.*pvScalarMember[field] = values.scalar[field];                                      break;
+      case PV_TYPE_STATE:   huawei.fve_state = FveStateFromString(values.fveState);                                    break;
+      case PV_TYPE_HISTORY: memcpy(huawei.*pvHistoryMember[field], PVValuesHistory(values, field), sizeof(PVHistory)); break;
+    }
+  }
+  huawei.UpdateMax();
+}
+
+/* 
+ * Read and decode a binary PV record from the http stream.
+ * A delta record is only applied on top of the snapshot with its base sequence number.
+ */
+int ApplyPVRecord(const uint8_t *buf, size_t len, uint32_t &seq, Huawei &huawei)
+{
+  PVValues values;
+
+  if (!PVRecordDecode(buf, len, values)) {
+    Serial.println("PV record invalid");
+    return -1;
+  }
+  if (values.baseSeq != 0 && values.baseSeq != seq) {
+    Serial.printf("PV delta for seq %u but have %u\n", values.baseSeq, seq);
+    seq = 0; // request a full snapshot next time
+    return -1;
+  }
+  ApplyPVValues(values, huawei);
+  seq = values.seq;
+
+  int missing = 0;
+  if (values.baseSeq == 0) {
+    for (int field = 0; field < PV_FIELD_COUNT; field++) {
+      if (!(values.mask & (1UL << field))) {
+        Serial.printf("PV field missing: %s\n", pvSchema[field].key);
+        missing++;
       }
-    } else {
-      Serial.print("[HTTP] GET... failed, error:");
-      Serial.println(http.errorToString(httpCode).c_str());
     }
-  http.end();  
+  }
+  return missing;
+}
 
-  DynamicJsonDocument doc(10 * 1024);
+/* Read a binary PV record from the http stream and apply it. */
+int ParsePVRecord(Stream &stream, int contentLength, uint32_t &seq, Huawei &huawei)
+{
+  uint8_t buf[PV_RECORD_MAX_SIZE];
+  size_t  len = stream.readBytes(buf, contentLength > 0 ? min(contentLength, PV_RECORD_MAX_SIZE) : PV_RECORD_MAX_SIZE);
 
-  DeserializationError error = deserializeJson(doc, payload);
+  return ApplyPVRecord(buf, len, seq, huawei);
+}
+
+#define PV_KEY_CASE(field, member, type, key, ...) case JsonHash(key): return field;
 
-  if (error) {
-    Serial.print(F("deserializeJson() failed: "));
-    Serial.println(error.f_str());
-    return;
+/* PVField of a json key hash, -1 for an unknown key. */
+int PVFieldOfHash(uint32_t hash)
+{
+  switch (hash) {
+    PV_SCHEMA(PV_KEY_CASE)
+    default: return -1;
   }
+}
 
-  JsonArray dayly_list  = doc["power_history"];
-      for (int i = 0; i < MAX_FORECAST; i++) {
-         if (i < dayly_list.size()) {
-            myData.huawei.historyPower[i]  = dayly_list[i].as<float>();
-            if (myData.huawei.historyPower[i] > myData.huawei.maxPower) {
-               myData.huawei.maxPower = myData.huawei.historyPower[i];
-            }
-         }
-      }
+/**
+  * Writes the values of the flat PV json straight into the fixed point snapshot.
+  */
+class PVJsonHandler : public JsonHandler
+{
+public:
+  PVSnapshot &snapshot; //!< Target of the values
+  uint32_t    found;    //!< Mask of the received PVFields
 
-  JsonArray dayly_list2  = doc["yeld_history"];
-      for (int i = 0; i < MAX_FORECAST; i++) {
-         if (i < dayly_list2.size()) {
-            myData.huawei.historyYeld[i]  = dayly_list2[i].as<float>();
-            if (myData.huawei.historyYeld[i] > myData.huawei.maxYeld) {
-               myData.huawei.maxYeld = myData.huawei.historyYeld[i];
-            }
-         }
+public:
+  PVJsonHandler(PVSnapshot &target)
+    : snapshot(target)
+    , found(0)
+  {
+  }
+
+  void Value(const JsonPath &path, const char *text, bool isString) override
+  {
+    int field = PVFieldOfHash(path.hash);
+
+    if (field < 0) {
+      return;
+    }
+    const PVFieldSchema &schema = pvSchema[field];
+
+    if (schema.type == PV_TYPE_STATE) {
+      PVSnapshotPut(snapshot, field, 0, FveStateFromString(text));
+    } else if (schema.type == PV_TYPE_NUMBER && path.depth == 0) {
+      PVSnapshotPut(snapshot, field, 0, JsonFixed(text, schema.scale));
+    } else if (schema.type == PV_TYPE_HISTORY && path.depth == 1 && path.index[0] < MAX_PV_HISTORY) {
+      if (path.index[0] == 0) {
+        memset(snapshot.data + pvSnapshotOffset[field], 0, PVFieldSize(field));
       }
+      PVSnapshotPut(snapshot, field, path.index[0], JsonFixed(text, schema.scale));
+    } else {
+      return;
+    }
+    found |= 1UL << field;
+  }
+};
+
+/* 
+ * Parse the PV json response directly from the http stream into the huawei data.
+ * One pass over the bytes without a document, a missing field is reported and 
+ * keeps its last value.
+ */
+int ParseHTTPValues(Stream &stream, Huawei &huawei)
+{
+  PVSnapshot    snapshot;
+  PVJsonHandler handler(snapshot);
+  JsonParser    parser(stream, handler);
+  int           missing = 0;
+
+  huawei.ToSnapshot(snapshot);
+  if (!parser.Parse()) {
+    Serial.println("PV json invalid");
+    return -1;
+  }
+  huawei.FromSnapshot(snapshot);
+
+  for (int field = 0; field < PV_FIELD_COUNT; field++) {
+    if (!(handler.found & (1UL << field))) {
+      Serial.printf("PV field missing: %s\n", pvSchema[field].key);
+      missing++;
+    }
+  }
+  return missing;
+}
+
+/* Load the last cached PV snapshot for the offline mode. */
+bool LoadCachedHTTPValues(MyData &myData)
+{
+  PVCacheRecord cache;
+
+  if (LoadNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache))) {
+    myData.huawei.FromSnapshot(cache.pv);
+    myData.pvChanged = 0;
+    return true;
+  }
+  return false;
+}
 
-  myData.huawei.panelPower = doc["fve_active_power"];
-  myData.huawei.yieldToday = doc["fve_daily_yield_energy"];
-  myData.huawei.power = doc["shelly_huawei_power"];
-  myData.huawei.grid_power = doc["power_meter_active_power"];
-  myData.huawei.boiler_status = doc["boiler_status"];
-  myData.huawei.boiler_power = doc["boiler_power"];
-  myData.huawei.boiler_water = doc["boiler_water"];
+/* Cache the PV snapshot of a source without http validators (MQTT, UDP). */
+bool SaveCachedPVValues(const Huawei &huawei, uint32_t seq, uint32_t epoch = 0)
+{
+  PVCacheRecord cache;
 
-  myData.huawei.grid_l1_power = doc["l1_power"];
-  myData.huawei.grid_l1_voltage = doc["l1_voltage"];
-  myData.huawei.grid_l1_current = doc["l1_current"];
+  memset(cache.etag,         0, sizeof(cache.etag));
+  memset(cache.lastModified, 0, sizeof(cache.lastModified));
+  cache.seq      = seq;
+  cache.epoch    = epoch;
+  cache.bodyHash = 0;
+  huawei.ToSnapshot(cache.pv);
+  return SaveNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache));
+}
 
-  myData.huawei.grid_l2_power = doc["l2_power"];
-  myData.huawei.grid_l2_voltage = doc["l2_voltage"];
-  myData.huawei.grid_l2_current = doc["l2_current"];
+/* 
+ * Read the PV values from URL. 
+ * Fields missing in the response keep the value of the last cached snapshot.
+ * The PVFields which changed against the cached snapshot are set in myData.pvChanged.
+ * A body with the hash of the last applied one is dropped after the download.
+ */
+bool GetHTTPValues(MyData &myData)
+{
+HTTPClient    http;
+PVCacheRecord cache;
+const char   *headerKeys[] = { "ETag", "Last-Modified", "Content-Type", "Content-Encoding" };
+bool          ret          = false;
 
-  myData.huawei.grid_l3_power = doc["l3_power"];
-  myData.huawei.grid_l3_voltage = doc["l3_voltage"];
-  myData.huawei.grid_l3_current = doc["l3_current"];
+  if (LoadNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache))) {
+    myData.huawei.FromSnapshot(cache.pv);
+    myData.pvChanged = 0;
+    if (cache.epoch) {
+      cache.seq   = 0; // a sequence number of the UDP gateway
+      cache.epoch = 0;
+    }
+  } else {
+    memset(cache.etag,         0, sizeof(cache.etag));
+    memset(cache.lastModified, 0, sizeof(cache.lastModified));
+    cache.seq        = 0;
+    cache.epoch      = 0;
+    cache.bodyHash   = 0;
+    myData.pvChanged = PV_ALL_FIELDS;
+  }
+  if (wakeBudget.Expired()) {
+    Serial.println("PV request skipped, budget exhausted");
+    return false;
+  }
 
-  myData.huawei.pv1_voltage = doc["fve_pv_01_voltage"];
-  myData.huawei.pv1_current = doc["fve_pv_01_current"];
-  myData.huawei.pv2_voltage = doc["fve_pv_02_voltage"];
-  myData.huawei.pv2_current = doc["fve_pv_02_current"];
+  http.begin(URL);
+  http.setConnectTimeout(wakeBudget.Remaining());
+  http.setTimeout(wakeBudget.Timeout());
+  http.useHTTP10(true); // no chunked transfer encoding, the body is read directly from the stream
+  http.collectHeaders(headerKeys, 4);
+  http.addHeader("Accept", PV_RECORD_MIME ", application/json;q=0.5");
+  http.addHeader("Accept-Encoding", ACCEPT_ENCODING);
+  if (cache.etag[0]) {
+    http.addHeader("If-None-Match", cache.etag);
+  }
+  if (cache.lastModified[0]) {
+    http.addHeader("If-Modified-Since", cache.lastModified);
+  }
+  if (cache.seq) {
+    http.addHeader(PV_SEQ_HEADER, String(cache.seq));
+  }
+  int httpCode = http.GET();
+  // httpCode will be negative on error
+  if (httpCode > 0) {
+    // HTTP header has been send and Server response header has been handled
+    Serial.print("[HTTP] GET... code:");
+    Serial.println(httpCode);
+
+    if (httpCode == HTTP_CODE_OK) {
+      InflateStream body(http.getStream());
+      String        encoding = http.header("Content-Encoding");
+      bool          binary   = http.header("Content-Type").startsWith(PV_RECORD_MIME);
+      uint32_t      seq      = cache.seq;
+      int           missing  = -1;
+      Huawei        parsed   = myData.huawei;
 
-  myData.huawei.pv_peak = doc["fve_day_active_power_peak"];
-  myData.huawei.fve_state = doc["fve_state"].as<String>();
+      body.SetDeadline(wakeBudget.Deadline());
+      if (body.Begin(encoding)) {
+        missing = binary ?
+                  ParsePVRecord(body, encoding.length() ? -1 : http.getSize(), seq, parsed) :
+                  ParseHTTPValues(body, parsed);
+      }
 
-  myData.huawei.gas = doc["gas"];
-  myData.huawei.water = doc["water"];
-  myData.huawei.elektrika = doc["power"];
-  myData.huawei.temp = doc["temp"];
+      if (missing >= 0 && cache.bodyHash && body.Hash() == cache.bodyHash) {
+        // byte identical to the applied body, nothing to apply, store or render
+        Serial.println("PV body unchanged");
+        ret = true;
+      } else if (missing >= 0) {
+        if (missing > 0) {
+          Serial.printf("PV response with %d missing fields\n", missing);
+        }
+        String etag         = http.header("ETag");
+        String lastModified = http.header("Last-Modified");
 
+        if (!binary) {
+          seq = 0;
+        }
+        myData.huawei     = parsed;
+        myData.pvChanged |= myData.huawei.Diff(cache.pv);
+        if (myData.pvChanged || seq != cache.seq || body.Hash() != cache.bodyHash ||
+            etag != cache.etag || lastModified != cache.lastModified) {
+          strlcpy(cache.etag,         etag.c_str(),         sizeof(cache.etag));
+          strlcpy(cache.lastModified, lastModified.c_str(), sizeof(cache.lastModified));
+          cache.seq      = seq;
+          cache.bodyHash = body.Hash();
+          myData.huawei.ToSnapshot(cache.pv);
+          SaveNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache));
+        }
+        ret = true;
+      } else if (seq != cache.seq) {
+        cache.seq = seq;
+        SaveNVSRecord(PV_RECORD_KEY, PV_RECORD_VERSION, &cache, sizeof(cache));
+      }
+    } else if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+      // nothing changed since the last response, the cached snapshot is already in place
+      ret = true;
+    }
+  } else {
+    Serial.print("[HTTP] GET... failed, error:");
+    Serial.println(http.errorToString(httpCode).c_str());
+  }
+  http.end();
+  return ret;
 }
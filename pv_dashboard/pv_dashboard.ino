@@ -32,11 +32,19 @@
 #include "EPD.h"
 #include "EPDWifi.h"
 #include "getJsonData.h"
+#ifdef PV_SOURCE_MQTT
+#include "MQTTData.h"
+#endif
+#ifdef PV_SOURCE_UDP
+#include "UDPData.h"
+#endif
 #include "SHT30.h"
 #include "RTCTime.h"
 #include "Utils.h"
-#include <ArduinoJson.h>
 #include "weather.h"
+#include "Scheduler.h"
+#include "WakeBudget.h"
+#include "WarmWake.h"
 
 MyData       myData;            // The collection of the global data
 SolarDisplay myDisplay(myData); // The global display helper class
@@ -48,20 +56,65 @@ void setup()
 
 
    // Serial default speed 115200
-   InitEPD(true);
+   InitEPD(false); // keep the panel content for the partial widget refresh
+   BeginWarmWake();
+   GetBatteryValues(myData);
+   GetSHT30Values(myData);
+   wakeBudget.Start(PHASE_WIFI);
    if (!StartWiFi(myData.wifiRSSI)) {
-      myDisplay.ShowWiFiError(WIFI_SSID);
+      // offline: show the cached data with a stale badge and retry with backoff
+      bool cached = LoadCachedHTTPValues(myData);
+
+      StopWiFi();
+      myData.weather.LoadCache();
+      WakeSchedule schedule = GetWakeSchedule(myData, false);
+
+      wakeBudget.Start(PHASE_RENDER);
+      if (cached) {
+         uint32_t widgets = myDisplay.DirtyWidgets();
+
+         if (widgets) {
+            myDisplay.Show(widgets);
+         }
+      } else {
+         myDisplay.ShowWiFiError(WIFI_SSID);
+      }
+      wakeBudget.Finish();
+      ShutdownScheduled(schedule);
    } else {
+      wakeBudget.Start(PHASE_NTP);
       UpdateRTCFromNTP();
-      GetBatteryValues(myData);
-      GetSHT30Values(myData);
-      GetHTTPValues(myData);
+      wakeBudget.Start(PHASE_PV);
+#if defined(PV_SOURCE_MQTT)
+      bool pvValid = GetMQTTValues(myData);
+#elif defined(PV_SOURCE_UDP)
+      bool pvValid = GetUDPValues(myData) || GetHTTPValues(myData);
+#else
+      bool pvValid = GetHTTPValues(myData);
+#endif
+      if (pvValid) {
+         myData.RecordHistory();
+      }
+      wakeBudget.Start(PHASE_WEATHER);
       myData.weather.Get();
       myData.Dump();
-      myDisplay.Show();
+
+      WakeSchedule schedule = GetWakeSchedule(myData);
+      uint32_t     widgets  = myDisplay.DirtyWidgets();
+
+      if (schedule.night) {
+         widgets = WIDGET_ALL; // leave a clean image for the night
+      }
       StopWiFi();
+      wakeBudget.Start(PHASE_RENDER);
+      if (widgets) {
+         myDisplay.Show(widgets);
+      } else {
+         Serial.println("No significant change, display kept");
+      }
+      wakeBudget.Finish();
+      ShutdownScheduled(schedule);
    }
-   ShutdownEPD(10 * 60); // every 10 minutes
 }
 
 /* Main loop. Never reached because of shutdown */
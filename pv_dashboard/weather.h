@@ -22,15 +22,22 @@
 #pragma once
 #include <HTTPClient.h>
 #include <WiFiClient.h>
-#include <ArduinoJson.h>
 #include "Utils.h"
+#include "NVSRecord.h"
+#include "InflateStream.h"
+#include "WakeBudget.h"
+#include "WeatherJson.h"
+#include <type_traits>
 
-#define MAX_HOURLY   24
-#define MAX_FORECAST  8
-#define MIN_RAIN     10
+#define WEATHER_EXCLUDE         "minutely,alerts"
+#define CURRENT_EXCLUDE         "minutely,hourly,daily,alerts"
+
+#define WEATHER_RECORD_KEY     "weather"
+#define WEATHER_RECORD_VERSION 3
 
 /**
   * Class for reading all the weather data from openweathermap.
+  * The data is plain old data without heap members.
   */
 class Weather
 {
@@ -45,8 +52,7 @@ public:
 
    time_t hourlyTime[MAX_HOURLY];          //!< timestamp of the hourly forecast
    float  hourlyMaxTemp[MAX_HOURLY];       //!< max temperature forecast
-   String hourlyMain[MAX_HOURLY];          //!< description of the hourly forecast
-   String hourlyIcon[MAX_HOURLY];          //!< openweathermap icon of the forecast weather
+   uint8_t hourlyCondition[MAX_HOURLY];    //!< WeatherCondition code of the hourly forecast
 
    int    maxRain;                         //!< maximum rain in mm of the day forecast
    float  forecastMaxTemp[MAX_FORECAST];   //!< max temperature
@@ -56,28 +62,44 @@ public:
    float  forecastClouds[MAX_FORECAST];  //!< humidity of the dayly forecast
    float  forecastPressure[MAX_FORECAST];  //!< air pressure
 
+   bool   updated;                         //!< New data was fetched in this wake
+
 protected:
-   /* Convert UTC time to local time */
-   time_t LocalTime(time_t time)
-   {
-      return time + currentTimeOffset;
-   }
+   time_t   fetchTime;                     //!< RTC time of the last full onecall request
+   time_t   currentFetchTime;              //!< RTC time of the last current conditions request
+   uint32_t forecastHash;                  //!< CRC32 of the last applied onecall body
+   uint32_t currentHash;                   //!< CRC32 of the last applied current conditions body
 
-   /* Calls the openweathermap request and deserialisation the json data. */
-   bool GetOpenWeatherJsonDoc(DynamicJsonDocument &doc)
+protected:
+   /* 
+    * Calls the openweathermap request and parses the body straight into the record, 
+    * hash is the CRC32 of the body. Without the forecast only the current 
+    * conditions of the record are replaced.
+    */
+   bool GetOpenWeather(WeatherRecord &record, String exclude, bool forecast, uint32_t &hash)
    {
-      WiFiClient client;
-      HTTPClient http;
-      String     uri;
+      const char *headerKeys[] = { "Content-Encoding" };
+      WiFiClient  client;
+      HTTPClient  http;
+      String      uri;
       
       uri += "/data/2.5/onecall";
       uri += "?lat=" + String((float) LATITUDE, 5);
       uri += "&lon=" + String((float) LONGITUDE, 5);
-      uri += "&units=metric&lang=en&exclude=minutely";
+      uri += "&units=metric&lang=en&exclude=" + exclude;
       uri += "&appid=" + (String) OPENWEATHER_API;
 
+      if (wakeBudget.Expired()) {
+         Serial.println("Weather request skipped, budget exhausted");
+         return false;
+      }
       client.stop();
       http.begin(client, OPENWEATHER_SRV, OPENWEATHER_PORT, uri);
+      http.setConnectTimeout(wakeBudget.Remaining());
+      http.setTimeout(wakeBudget.Timeout());
+      http.useHTTP10(true); // no chunked transfer encoding, the body is read directly from the stream
+      http.collectHeaders(headerKeys, 1);
+      http.addHeader("Accept-Encoding", ACCEPT_ENCODING);
       Serial.println(uri);
       int httpCode = http.GET();
       
@@ -87,61 +109,101 @@ protected:
          http.end();
          return false;
       } else {
-         DeserializationError error = deserializeJson(doc, http.getStream());
-         
-         if (error) {
-            Serial.print(F("deserializeJson() failed: "));
-            Serial.println(error.c_str());
+         InflateStream      body(http.getStream());
+         WeatherJsonHandler handler(record, forecast);
+         JsonParser         parser(body, handler);
+
+         body.SetDeadline(wakeBudget.Deadline());
+         if (!body.Begin(http.header("Content-Encoding"))) {
+            http.end();
+            return false;
+         }
+         bool ok = parser.Parse();
+
+         Serial.printf("Weather: %u bytes received\n", body.Received());
+         hash = body.Hash();
+         http.end();
+         if (!ok) {
+            Serial.println("Weather json invalid");
             return false;
-         } else {
-            return true;
          }
+         handler.Finish();
+         return true;
       }
    }
 
-   /* Fill from the json data into the internal data. */
-   bool Fill(const JsonObject &root) 
+   /* Copy the internal data into the compact cache record. */
+   void ToRecord(WeatherRecord &record)
    {
-      Clear();
+      memset(&record, 0, sizeof(record));
+      record.fetchTime         = fetchTime;
+      record.currentFetchTime  = currentFetchTime;
+      record.forecastHash      = forecastHash;
+      record.currentHash       = currentHash;
+      record.currentTime       = currentTime;
+      record.currentTimeOffset = currentTimeOffset;
+      record.sunrise           = sunrise;
+      record.sunset            = sunset;
+      record.winddir           = winddir;
+      record.windspeed         = round(windspeed * 100);
+      record.maxRain           = maxRain;
+      for (int i = 0; i < MAX_HOURLY; i++) {
+         record.hourlyTime[i]      = hourlyTime[i];
+         record.hourlyMaxTemp[i]   = round(hourlyMaxTemp[i] * 100);
+         record.hourlyCondition[i] = hourlyCondition[i];
+      }
+      for (int i = 0; i < MAX_FORECAST; i++) {
+         record.forecastMaxTemp[i]  = round(forecastMaxTemp[i] * 100);
+         record.forecastMinTemp[i]  = round(forecastMinTemp[i] * 100);
+         record.forecastRain[i]     = round(forecastRain[i] * 10);
+         record.forecastHumidity[i] = forecastHumidity[i];
+         record.forecastClouds[i]   = forecastClouds[i];
+         record.forecastPressure[i] = forecastPressure[i];
+      }
+   }
 
-      currentTimeOffset = root["timezone_offset"].as<int>();
-      currentTime       = LocalTime(root["current"]["dt"].as<int>());
-
-      sunrise           = LocalTime(root["current"]["sunrise"].as<int>());
-      sunset            = LocalTime(root["current"]["sunset"].as<int>());
-      winddir           = root["current"]["wind_deg"].as<float>();
-      windspeed         = root["current"]["wind_speed"].as<float>();
-
-      JsonArray hourly_list = root["hourly"];
-      hourlyTime[0]    = LocalTime(root["current"]["dt"].as<int>());
-      hourlyMaxTemp[0] = root["current"]["temp"].as<float>();
-      hourlyMain[0]    = root["current"]["weather"][0]["main"].as<char *>();
-      hourlyIcon[0]    = root["current"]["weather"][0]["icon"].as<char *>();
-      for (int i = 1; i < MAX_HOURLY; i++) {
-         if (i < hourly_list.size()) {
-            hourlyTime[i]    = LocalTime(hourly_list[i - 1]["dt"].as<int>());
-            hourlyMaxTemp[i] = hourly_list[i - 1]["temp"].as<float>();
-            hourlyMain[i]    = hourly_list[i - 1]["weather"][0]["main"].as<char *>();
-            hourlyIcon[i]    = hourly_list[i - 1]["weather"][0]["icon"].as<char *>();
-         }
+   /* Fill the internal data from the compact cache record. */
+   void FromRecord(const WeatherRecord &record)
+   {
+      fetchTime         = record.fetchTime;
+      currentFetchTime  = record.currentFetchTime;
+      forecastHash      = record.forecastHash;
+      currentHash       = record.currentHash;
+      currentTime       = record.currentTime;
+      currentTimeOffset = record.currentTimeOffset;
+      sunrise           = record.sunrise;
+      sunset            = record.sunset;
+      winddir           = record.winddir;
+      windspeed         = record.windspeed / 100.0;
+      maxRain           = record.maxRain;
+      for (int i = 0; i < MAX_HOURLY; i++) {
+         hourlyTime[i]      = record.hourlyTime[i];
+         hourlyMaxTemp[i]   = record.hourlyMaxTemp[i] / 100.0;
+         hourlyCondition[i] = record.hourlyCondition[i];
       }
-      
-      JsonArray dayly_list  = root["daily"];
       for (int i = 0; i < MAX_FORECAST; i++) {
-         if (i < dayly_list.size()) {
-            forecastMaxTemp[i]  = dayly_list[i]["temp"]["max"].as<float>();
-            forecastMinTemp[i]  = dayly_list[i]["temp"]["min"].as<float>();
-            forecastRain[i]     = dayly_list[i]["rain"].as<float>();
-            forecastHumidity[i] = dayly_list[i]["humidity"].as<float>();
-            forecastClouds[i] = dayly_list[i]["clouds"].as<float>();
-            forecastPressure[i] = dayly_list[i]["pressure"].as<float>();
-            if (forecastRain[i] > maxRain) {
-               maxRain = forecastRain[i];
-            }
-         }
+         forecastMaxTemp[i]  = record.forecastMaxTemp[i] / 100.0;
+         forecastMinTemp[i]  = record.forecastMinTemp[i] / 100.0;
+         forecastRain[i]     = record.forecastRain[i] / 10.0;
+         forecastHumidity[i] = record.forecastHumidity[i];
+         forecastClouds[i]   = record.forecastClouds[i];
+         forecastPressure[i] = record.forecastPressure[i];
       }
-          
-      return true;
+   }
+
+   /* Store the weather data into the non volatile cache. */
+   bool SaveCache()
+   {
+      WeatherRecord record;
+
+      ToRecord(record);
+      return SaveNVSRecord(WEATHER_RECORD_KEY, WEATHER_RECORD_VERSION, &record, sizeof(record));
+   }
+
+   /* Check if the cache timestamp is younger than ttl seconds. */
+   bool IsFresh(time_t timestamp, time_t now, long ttl)
+   {
+      return timestamp > 0 && now >= timestamp && now - timestamp < ttl;
    }
 
 public:
@@ -153,6 +215,11 @@ public:
       , winddir(0)
       , windspeed(0)
       , maxRain(MIN_RAIN)
+      , updated(false)
+      , fetchTime(0)
+      , currentFetchTime(0)
+      , forecastHash(0)
+      , currentHash(0)
    {
       Clear();
    }
@@ -167,23 +234,106 @@ public:
       winddir           = 0;
       windspeed         = 0;
       maxRain           = MIN_RAIN;
+      memset(hourlyTime,       0, sizeof(hourlyTime));
       memset(hourlyMaxTemp,    0, sizeof(hourlyMaxTemp));
+      memset(hourlyCondition,  0, sizeof(hourlyCondition));
       memset(forecastMaxTemp,  0, sizeof(forecastMaxTemp));
       memset(forecastMinTemp,  0, sizeof(forecastMinTemp));
       memset(forecastRain,     0, sizeof(forecastRain));
       memset(forecastHumidity, 0, sizeof(forecastHumidity));
-      memset(forecastClouds, 0, sizeof(forecastClouds));
+      memset(forecastClouds,   0, sizeof(forecastClouds));
       memset(forecastPressure, 0, sizeof(forecastPressure));
    }
 
-   /* Start the request and the filling. */
+   /* Load the cached weather data from the non volatile memory. */
+   bool LoadCache()
+   {
+      WeatherRecord record;
+
+      if (LoadNVSRecord(WEATHER_RECORD_KEY, WEATHER_RECORD_VERSION, &record, sizeof(record))) {
+         FromRecord(record);
+         return true;
+      }
+      return false;
+   }
+
+   /* 
+    * Take over the record of a PG_WEATHER datagram (see UDPData.h) instead
+    * of the own request. The record is cached as just fetched, so Get() 
+    * answers from the cache in this wake. A record with the forecastHash
+    * of the cached data only renews the fetch time.
+    */
+   void SetRecord(const WeatherRecord &record)
+   {
+      time_t now    = GetRTCTime();
+      bool   cached = LoadCache();
+
+      if (cached && record.forecastHash == forecastHash) {
+         Serial.println("Weather of the gateway unchanged");
+      } else {
+         FromRecord(record);
+         updated = true;
+      }
+      fetchTime        = now;
+      currentFetchTime = now;
+      SaveCache();
+   }
+
+   /* 
+    * Start the request and the filling.
+    * The onecall request is skipped while the cached data is younger than
+    * WEATHER_FORECAST_TTL, the current conditions alone are refreshed after
+    * WEATHER_CURRENT_TTL. A body identical to the last applied one only
+    * renews the fetch time, the data and the display stay untouched.
+    */
    bool Get()
    {
-      DynamicJsonDocument doc(35 * 1024);
+      time_t now    = GetRTCTime();
+      bool   cached = LoadCache();
+
+      if (cached && IsFresh(fetchTime, now, WEATHER_FORECAST_TTL)) {
+         if (IsFresh(currentFetchTime, now, WEATHER_CURRENT_TTL)) {
+            Serial.println("Weather from cache");
+            return true;
+         }
+         WeatherRecord record;
+         uint32_t      hash;
+
+         ToRecord(record);
+         if (GetOpenWeather(record, CURRENT_EXCLUDE, false, hash)) {
+            if (hash != currentHash) {
+               FromRecord(record);
+               currentHash = hash;
+               updated     = true;
+            } else {
+               Serial.println("Weather current unchanged");
+            }
+            currentFetchTime = now;
+            SaveCache();
+         }
+         return true;
+      }
+
+      WeatherRecord record;
+      uint32_t      hash;
    
-      if (GetOpenWeatherJsonDoc(doc)) {
-         return Fill(doc.as<JsonObject>());
+      memset(&record, 0, sizeof(record));
+      if (GetOpenWeather(record, WEATHER_EXCLUDE, true, hash)) {
+         if (cached && hash == forecastHash) {
+            Serial.println("Weather unchanged");
+         } else {
+            FromRecord(record);
+            forecastHash = hash;
+            currentHash  = 0;
+            updated      = true;
+         }
+         fetchTime        = now;
+         currentFetchTime = now;
+         SaveCache();
+         return true;
       }
-      return false;
+      return cached;
    }
 };
+
+static_assert(std::is_trivially_copyable<Weather>::value, "Weather is plain old data");
@@ -0,0 +1,36 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file Check.h
+  * 
+  * Assertions of the host tests: CHECK() reports a failed condition and 
+  * continues, CheckResult() prints the "name: ok" or "name: FAILED" line
+  * of make check and returns the exit code.
+  */
+#pragma once
+#include <stdio.h>
+
+#define CHECK(cond) do { if (!(cond)) { fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); checkFailed++; } } while (0)
+
+static int checkFailed = 0; // number of failed CHECKs
+
+/* Print the result line of the test, the exit code of main(). */
+static int CheckResult(const char *name)
+{
+   printf("%s: %s\n", name, checkFailed ? "FAILED" : "ok");
+   return checkFailed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file datagram_loopback.cpp
+  * 
+  * Runs gateway/pv_gateway on the loopback interface and plays the 
+  * dashboard side of the UDP protocol (PVDatagram.h, PVRecord.h): full
+  * snapshot, nothing new, delta after a change of pv.json and a full 
+  * snapshot of a new epoch after a restart of the gateway. The weather
+  * command of the gateway prints an onecall json, the weather record 
+  * behind every PV record has to carry its values, and a changed json 
+  * has to arrive with the next weather seq.
+  *
+  * Usage: datagram_loopback path/to/pv_gateway
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <utime.h>
+#include <time.h>
+#include <string>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Check.h"
+#include "PVRecord.h"
+#include "PVDatagram.h"
+#include "Crc32.h"
+#include "WeatherRecord.h"
+
+
+/* Write pv.json with the panel power and move its mtime forward. */
+static void WritePV(const char *path, int panelPower, time_t mtime)
+{
+   FILE          *file = fopen(path, "w");
+   struct utimbuf times;
+
+   fprintf(file, "{\"fve_active_power\": %d, \"power_meter_active_power\": -120, "
+                 "\"fve_state\": \"On-grid\", \"power_history\": [1.5, 2.25]}\n", panelPower);
+   fclose(file);
+   times.actime  = mtime;
+   times.modtime = mtime;
+   utime(path, &times);
+}
+
+/* Write the onecall json with the current temperature and return it. */
+static std::string WriteWeather(const char *path, const char *temp)
+{
+   std::string json = std::string("{\"lat\":48.35,\"timezone_offset\":7200,"
+      "\"current\":{\"dt\":1660000000,\"sunrise\":1659990000,\"sunset\":1660040000,\"temp\":") + temp + ","
+      "\"wind_speed\":3.5,\"wind_deg\":200,\"weather\":[{\"id\":500,\"main\":\"Rain\",\"icon\":\"10n\"}]},"
+      "\"hourly\":[{\"dt\":1660003600,\"temp\":20.5,\"weather\":[{\"id\":800,\"icon\":\"01d\"}]}],"
+      "\"daily\":[{\"temp\":{\"min\":12.3,\"max\":25.1},\"rain\":4.2,\"humidity\":60,\"clouds\":40,\"pressure\":1013}]}";
+   FILE       *file = fopen(path, "w");
+
+   fputs(json.c_str(), file);
+   fclose(file);
+   return json;
+}
+
+/* Start the gateway on port, the weather command prints weatherFile every second. */
+static pid_t StartGateway(const char *gateway, const char *pvFile, const char *weatherFile, int port)
+{
+   char        portText[16];
+   std::string command = std::string("cat ") + weatherFile;
+   pid_t       pid     = fork();
+
+   snprintf(portText, sizeof(portText), "%d", port);
+   if (pid == 0) {
+      freopen("/dev/null", "w", stdout);
+      execl(gateway, gateway, pvFile, "-p", portText, "-w", command.c_str(), "1", (char *) NULL);
+      _exit(127);
+   }
+   return pid;
+}
+
+static void StopGateway(pid_t pid)
+{
+   kill(pid, SIGTERM);
+   waitpid(pid, NULL, 0);
+}
+
+/**
+  * Decoded answer of the gateway.
+  */
+struct Answer
+{
+   PGHeader      header;        //!< Header of the PV datagram
+   PVValues      values;        //!< PV record
+   PGHeader      weatherHeader; //!< Header of the weather datagram
+   WeatherRecord weather;       //!< Weather record
+};
+
+/* Send a PG_REQUEST and decode the PG_PV answer and the PG_WEATHER datagram behind it, false on a timeout. */
+static bool Request(int sock, int port, uint32_t seq, uint32_t epoch, Answer &answer)
+{
+   uint8_t     buf[PG_MAX_DATAGRAM];
+   size_t      len = PGEncode(buf, sizeof(buf), PG_REQUEST, seq, epoch, NULL, 0);
+   sockaddr_in to;
+
+   memset(&to, 0, sizeof(to));
+   to.sin_family      = AF_INET;
+   to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   to.sin_port        = htons(port);
+   sendto(sock, buf, len, 0, (const sockaddr *) &to, sizeof(to));
+
+   ssize_t size = recv(sock, buf, sizeof(buf), 0);
+
+   memset(&answer, 0, sizeof(answer));
+   if (size <= 0 || !PGDecode(buf, size, answer.header) || answer.header.type != PG_PV ||
+       !PVRecordDecode(buf + PG_HEADER, answer.header.length, answer.values)) {
+      return false;
+   }
+   size = recv(sock, buf, sizeof(buf), 0);
+   if (size <= 0 || !PGDecode(buf, size, answer.weatherHeader) || answer.weatherHeader.type != PG_WEATHER ||
+       answer.weatherHeader.length != sizeof(WeatherRecord)) {
+      return false;
+   }
+   memcpy(&answer.weather, buf + PG_HEADER, sizeof(answer.weather));
+   return true;
+}
+
+/* Request until the weather record has another seq than weatherSeq (the command runs every second). */
+static bool WaitForWeather(int sock, int port, uint32_t seq, uint32_t epoch, uint32_t weatherSeq, Answer &answer)
+{
+   for (int i = 0; i < 30; i++) {
+      if (Request(sock, port, seq, epoch, answer) && answer.weatherHeader.seq != weatherSeq) {
+         return true;
+      }
+      usleep(100000);
+   }
+   return false;
+}
+
+/* Request until the gateway answers with a snapshot other than seq/epoch (it polls pv.json every second). */
+static bool WaitForSnapshot(int sock, int port, uint32_t seq, uint32_t epoch, Answer &answer)
+{
+   for (int i = 0; i < 30; i++) {
+      if (Request(sock, port, seq, epoch, answer) && (answer.header.seq != seq || answer.header.epoch != epoch)) {
+         return true;
+      }
+      usleep(100000);
+   }
+   return false;
+}
+
+int main(int argc, char *argv[])
+{
+   char           pvFile[]      = "/tmp/pv_loopbackXXXXXX";
+   char           weatherFile[] = "/tmp/weather_loopbackXXXXXX";
+   int            port          = 20000 + getpid() % 20000;
+   time_t         mtime         = time(NULL) - 100;
+   int            sock          = socket(AF_INET, SOCK_DGRAM, 0);
+   timeval        timeout       = { 0, 200000 };
+   Answer         answer;
+   PGHeader      &header        = answer.header;
+   PVValues      &values        = answer.values;
+   WeatherRecord &weather       = answer.weather;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s pv_gateway\n", argv[0]);
+      return 2;
+   }
+   close(mkstemp(pvFile));
+   close(mkstemp(weatherFile));
+   setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+   WritePV(pvFile, 1500, mtime);
+   std::string json = WriteWeather(weatherFile, "21.37");
+
+   pid_t pid = StartGateway(argv[1], pvFile, weatherFile, port);
+
+   // first wake: full snapshot
+   CHECK(WaitForSnapshot(sock, port, 0, 0, answer));
+   CHECK(values.baseSeq == 0);
+   CHECK(values.mask == PV_ALL_FIELDS);
+   CHECK(values.scalar[PV_PANEL_POWER] == 1500);
+   CHECK(values.scalar[PV_GRID_POWER] == -120);
+   CHECK(strcmp(values.fveState, "On-grid") == 0);
+   CHECK(values.historyPower[1] == 2.25f);
+   uint32_t seq   = header.seq;
+   uint32_t epoch = header.epoch;
+
+   // the weather record behind it, parsed by WeatherJsonHandler with the times in local time
+   uint32_t weatherSeq = answer.weatherHeader.seq;
+
+   CHECK(answer.weatherHeader.epoch == epoch);
+   CHECK(weather.forecastHash == Crc32(json.data(), json.size()));
+   CHECK(weather.currentTime == 1660000000 + 7200 && weather.currentTimeOffset == 7200);
+   CHECK(weather.sunrise == 1659990000 + 7200 && weather.sunset == 1660040000 + 7200);
+   CHECK(weather.hourlyMaxTemp[0] == 2137 && weather.winddir == 200 && weather.windspeed == 350);
+   CHECK(weather.hourlyCondition[0] == (CONDITION_RAIN | CONDITION_NIGHT));
+   CHECK(weather.hourlyTime[1] == 1660003600 + 7200 && weather.hourlyMaxTemp[1] == 2050);
+   CHECK(weather.hourlyCondition[1] == CONDITION_CLEAR);
+   CHECK(weather.forecastMaxTemp[0] == 2510 && weather.forecastMinTemp[0] == 1230 && weather.forecastRain[0] == 42);
+   CHECK(weather.forecastHumidity[0] == 60 && weather.forecastClouds[0] == 40 && weather.forecastPressure[0] == 1013);
+
+   // nothing changed: empty delta on the base, the weather command ran again with the same body
+   usleep(1200000);
+   CHECK(Request(sock, port, seq, epoch, answer));
+   CHECK(header.seq == seq && values.baseSeq == seq && values.mask == 0);
+   CHECK(answer.weatherHeader.seq == weatherSeq && weather.hourlyMaxTemp[0] == 2137);
+
+   // the onecall json changed: the next weather record
+   json = WriteWeather(weatherFile, "18.5");
+   CHECK(WaitForWeather(sock, port, seq, epoch, weatherSeq, answer));
+   CHECK(answer.weatherHeader.seq == weatherSeq + 1);
+   CHECK(weather.forecastHash == Crc32(json.data(), json.size()));
+   CHECK(weather.hourlyMaxTemp[0] == 1850);
+
+   // pv.json changed: delta with the panel power only
+   WritePV(pvFile, 1750, mtime + 10);
+   CHECK(WaitForSnapshot(sock, port, seq, epoch, answer));
+   CHECK(values.baseSeq == seq);
+   CHECK(values.mask == (1UL << PV_PANEL_POWER));
+   CHECK(values.scalar[PV_PANEL_POWER] == 1750);
+   seq = header.seq;
+
+   // restart: new epoch, the old base is not used for a delta
+   StopGateway(pid);
+   sleep(1);
+   pid = StartGateway(argv[1], pvFile, weatherFile, port);
+   CHECK(WaitForSnapshot(sock, port, seq, epoch, answer));
+   CHECK(header.epoch != epoch);
+   CHECK(values.baseSeq == 0 && values.mask == PV_ALL_FIELDS);
+   CHECK(values.scalar[PV_PANEL_POWER] == 1750);
+   CHECK(weather.hourlyMaxTemp[0] == 1850);
+
+   StopGateway(pid);
+   close(sock);
+   unlink(pvFile);
+   unlink(weatherFile);
+   return CheckResult("datagram_loopback");
+}
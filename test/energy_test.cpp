@@ -0,0 +1,81 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file energy_test.cpp
+  * 
+  * Checks the integration of EnergyStats.h: the trapezoid with a zero 
+  * crossing of the grid power, the split at midnight and a night gap 
+  * filled from the meter counters.
+  */
+#include <stdio.h>
+#include <math.h>
+#include "Check.h"
+#include "EnergyStats.h"
+
+#define NEAR(a, b) (fabs((a) - (b)) < 0.01)
+
+static EnergySample Sample(uint32_t time, float panel, float grid, float boiler, float meterKWh, float yieldKWh)
+{
+   EnergySample sample = { time, panel, grid, boiler, meterKWh, yieldKWh };
+
+   return sample;
+}
+
+int main()
+{
+   EnergyRecord record;
+   uint32_t     day = 20000 * ENERGY_DAY;
+
+   memset(&record, 0, sizeof(record));
+
+   // 10 minutes with the grid from 500 W export to 500 W import
+   EnergyAdd(record, Sample(day + 12 * 3600,       1000,  500,   0, 1000, 10));
+   EnergyAdd(record, Sample(day + 12 * 3600 + 600, 1000, -500, 200, 1000, 10.2));
+   CHECK(NEAR(record.today.producedWh, 166.67));
+   CHECK(NEAR(record.today.exportWh,    20.83));
+   CHECK(NEAR(record.today.importWh,    20.83));
+   CHECK(NEAR(record.today.selfWh,     125.00));
+   CHECK(NEAR(record.today.boilerWh,    16.67));
+   CHECK(record.today.covered == 600);
+
+   // 10 minutes over midnight, constant 600 W import
+   memset(&record, 0, sizeof(record));
+   EnergyAdd(record, Sample(day + ENERGY_DAY - 300, 0, -600, 0, 1000, 20));
+   EnergyAdd(record, Sample(day + ENERGY_DAY + 300, 0, -600, 0, 1000.1, 0));
+   CHECK(record.today.day == 20001 && record.yesterday.day == 20000);
+   CHECK(NEAR(record.yesterday.importWh, 50) && NEAR(record.today.importWh, 50));
+
+   // the night from 22:00 to 06:00 without a wake: 4 kWh import, 0.1 kWh yield in the morning
+   memset(&record, 0, sizeof(record));
+   EnergyAdd(record, Sample(day + 22 * 3600,              0, -500, 0, 1000, 20));
+   EnergyAdd(record, Sample(day + ENERGY_DAY + 6 * 3600, 100, -300, 0, 1004, 0.1));
+   CHECK(NEAR(record.yesterday.importWh, 1000));
+   CHECK(NEAR(record.today.importWh,     3000));
+   CHECK(NEAR(record.today.producedWh,    100));
+   CHECK(NEAR(record.today.selfWh,        100));
+   CHECK(record.yesterday.filled == 2 * 3600 && record.today.filled == 6 * 3600);
+   CHECK(record.today.gap == 0);
+   CHECK(NEAR(EnergyAutarky(record.today), 100.0 / 3100));
+
+   // no meter reading: the gap stays a gap
+   memset(&record, 0, sizeof(record));
+   EnergyAdd(record, Sample(day + 8 * 3600,  0, -500, 0, 0, 1));
+   EnergyAdd(record, Sample(day + 10 * 3600, 0, -500, 0, 0, 2));
+   CHECK(record.today.gap == 2 * 3600 && record.today.importWh == 0);
+
+   return CheckResult("energy_test");
+}
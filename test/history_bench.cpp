@@ -0,0 +1,142 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file history_bench.cpp
+  * 
+  * Round trip and throughput of HistoryBlock.h on a simulated power 
+  * series: wakes every 5-15 minutes, random steps, a night at 0 W and 
+  * a clock which sometimes jumps. Every block is decoded and compared 
+  * with the appended samples, then the append and decode rates and the 
+  * bytes per sample are printed.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "HistoryBlock.h"
+
+#define SAMPLES 200000
+#define ROUNDS  20
+
+struct Sample
+{
+   uint32_t time;  //!< Minutes since 1970
+   int16_t  value; //!< Fixed point value
+};
+
+static double Seconds()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Power series of the simulated wakes. */
+static void MakeSeries(std::vector<Sample> &series)
+{
+   uint32_t time  = 28000000;
+   int32_t  value = 0;
+
+   srand(1);
+   for (int i = 0; i < SAMPLES; i++) {
+      time += 5 + (rand() % 3) * 5;
+      if (rand() % 500 == 0) {
+         time += rand() % 100000;
+      }
+      if ((time / 60) % 24 < 6) {
+         value = 0;
+      } else if (rand() % 3) {
+         value += rand() % 801 - 400;
+      }
+      value = value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+      Sample sample = { time, (int16_t) value };
+      series.push_back(sample);
+   }
+}
+
+/* Append the series into blocks, a new block when the last is full. */
+static void Encode(const std::vector<Sample> &series, std::vector<HistoryBlock> &blocks)
+{
+   blocks.clear();
+   for (size_t i = 0; i < series.size(); i++) {
+      if (blocks.empty() || !HistoryBlockAppend(blocks.back(), series[i].time, series[i].value)) {
+         blocks.push_back(HistoryBlock());
+         HistoryBlockInit(blocks.back(), series[i].time, series[i].value);
+      }
+   }
+}
+
+/* Decode all blocks, the number of samples which differ from the series. */
+static size_t Verify(const std::vector<Sample> &series, const std::vector<HistoryBlock> &blocks, size_t &count)
+{
+   size_t bad = 0;
+
+   count = 0;
+   for (size_t b = 0; b < blocks.size(); b++) {
+      HistoryCursor cursor;
+      uint32_t      time;
+      int16_t       value;
+
+      HistoryCursorBegin(cursor, blocks[b]);
+      while (HistoryCursorNext(cursor, time, value)) {
+         if (count >= series.size() || series[count].time != time || series[count].value != value) {
+            bad++;
+         }
+         count++;
+      }
+   }
+   return bad;
+}
+
+int main()
+{
+   std::vector<Sample>       series;
+   std::vector<HistoryBlock> blocks;
+   size_t                    count = 0;
+   size_t                    bad   = 0;
+   size_t                    used  = 0;
+
+   MakeSeries(series);
+   Encode(series, blocks);
+   bad = Verify(series, blocks, count);
+   if (bad || count != series.size()) {
+      printf("history_bench: FAILED, %zu of %zu samples differ, %zu decoded\n", bad, series.size(), count);
+      return 1;
+   }
+   for (size_t b = 0; b < blocks.size(); b++) {
+      used += (blocks[b].bits + 7) / 8;
+   }
+
+   double start = Seconds();
+   for (int i = 0; i < ROUNDS; i++) {
+      Encode(series, blocks);
+   }
+   double encode = Seconds() - start;
+
+   start = Seconds();
+   for (int i = 0; i < ROUNDS; i++) {
+      Verify(series, blocks, count);
+   }
+   double decode = Seconds() - start;
+
+   printf("history_bench: ok, %zu samples in %zu blocks, %.2f data bytes per sample\n", 
+          series.size(), blocks.size(), (double) used / series.size());
+   printf("history_bench: append %.1f Msamples/s, decode %.1f Msamples/s\n", 
+          SAMPLES * ROUNDS / encode / 1e6, SAMPLES * ROUNDS / decode / 1e6);
+   return 0;
+}
@@ -0,0 +1,186 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file history_test.cpp
+  * 
+  * Checks HistoryRing.h on ten days of simulated wakes: the decoded blocks
+  * against the appended samples after the ring wrapped, and the raw, 
+  * hourly and daily Query against a brute force aggregation of the samples,
+  * with aligned and unaligned ranges, before and after the clock went back.
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Check.h"
+#include "HistoryRing.h"
+
+#define BLOCKS 4
+#define DAYS   10
+#define POINTS 64
+
+struct Sample
+{
+   time_t  time;  //!< Seconds since 1970
+   int16_t value; //!< Fixed point value
+};
+
+/* Append the samples of the simulated wakes every 5-15 minutes from time to end. */
+static void AppendSeries(HistoryRing &ring, std::vector<Sample> &samples, time_t time, time_t end)
+{
+   int16_t value = 1000;
+
+   while (time < end) {
+      int hour = time / 3600 % 24;
+
+      value   += rand() % 201 - 100;
+      value    = value < 0 ? 0 : value;
+      Sample s = { time, (int16_t) (hour < 6 || hour >= 20 ? 0 : value) };
+      ring.AppendSample(s.time, s.value);
+      samples.push_back(s);
+      time += 5 * 60 + rand() % (10 * 60 + 1);
+   }
+}
+
+/* Brute force aggregation of the samples of a tier which keeps the newest size buckets. */
+static void TierExpect(const std::vector<Sample> &samples, uint32_t width, int size,
+                       uint32_t start, uint32_t step, HistoryPoint *points, int count)
+{
+   std::vector<int> bucketOf(samples.size());
+   int              buckets = 0;
+
+   for (size_t i = 0; i < samples.size(); i++) {
+      uint32_t minutes = samples[i].time / 60;
+
+      if (i == 0 || minutes - minutes % width != samples[i - 1].time / 60 - samples[i - 1].time / 60 % width) {
+         buckets++;
+      }
+      bucketOf[i] = buckets;
+   }
+   for (size_t i = 0; i < samples.size(); i++) {
+      uint32_t minutes = samples[i].time / 60;
+      uint32_t bucket  = minutes - minutes % width;
+      uint32_t first   = bucket > start ? bucket : start;
+
+      if (bucketOf[i] > buckets - size && bucket + width > start && first < start + step * count) {
+         HistoryPointMerge(points[(first - start) / step], samples[i].value, samples[i].value, samples[i].value, 1);
+      }
+   }
+}
+
+/* Query the ring and compare with the brute force aggregation of the samples, raw the ones in the blocks. */
+static void CheckQuery(HistoryRing &ring, const std::vector<Sample> &samples, const std::vector<Sample> &raw,
+                       time_t from, time_t to, int count)
+{
+   HistoryPoint points[POINTS];
+   HistoryPoint expect[POINTS];
+   uint32_t     start = from / 60;
+   uint32_t     step  = (to - from) / 60 / count;
+
+   ring.Query(from, to, count, points);
+   HistoryPointsInit(expect, count, start, step);
+   if (step >= HISTORY_DAY) {
+      TierExpect(samples, HISTORY_DAY, HISTORY_DAYS, start, step, expect, count);
+   } else if (step >= HISTORY_HOUR) {
+      TierExpect(samples, HISTORY_HOUR, HISTORY_HOURS, start, step, expect, count);
+   } else {
+      for (size_t i = raw.size() - ring.Count(); i < raw.size(); i++) {
+         uint32_t minutes = raw[i].time / 60;
+
+         if (minutes >= start && minutes < start + step * count) {
+            HistoryPointMerge(expect[(minutes - start) / step], raw[i].value, raw[i].value, raw[i].value, 1);
+         }
+      }
+   }
+   int filled = 0;
+
+   for (int i = 0; i < count; i++) {
+      CHECK(points[i].start == expect[i].start);
+      CHECK(points[i].count == expect[i].count);
+      CHECK(points[i].sum   == expect[i].sum);
+      if (expect[i].count) {
+         CHECK(points[i].min == expect[i].min);
+         CHECK(points[i].max == expect[i].max);
+         filled++;
+      }
+   }
+   CHECK(filled > 0);
+}
+
+/* Decode the blocks oldest first and compare with the newest samples. */
+static void CheckBlocks(HistoryRing &ring, const std::vector<Sample> &raw)
+{
+   size_t next = raw.size() - ring.Count();
+
+   for (int i = 0; i < ring.Blocks(); i++) {
+      HistoryCursor cursor;
+      uint32_t      minutes;
+      int16_t       sample;
+
+      HistoryCursorBegin(cursor, ring.Block(i));
+      while (HistoryCursorNext(cursor, minutes, sample)) {
+         CHECK(next < raw.size() && minutes == raw[next].time / 60 && sample == raw[next].value);
+         next++;
+      }
+   }
+   CHECK(next == raw.size());
+}
+
+/* All queries of a day, week and the tiers, some with an unaligned from. */
+static void CheckQueries(HistoryRing &ring, const std::vector<Sample> &samples, const std::vector<Sample> &raw)
+{
+   time_t now = raw.back().time;
+
+   CheckQuery(ring, samples, raw, now - 6 * 3600, now, 36);                  // raw, 10 minutes
+   CheckQuery(ring, samples, raw, now - 6 * 3600 - 437, now, 36);            // raw, unaligned
+   CheckQuery(ring, samples, raw, now - 59 * 60 * 8, now, 8);                // raw, 59 minutes
+   CheckQuery(ring, samples, raw, now - 60 * 3600, now, 60);                 // hours, older than the tier
+   CheckQuery(ring, samples, raw, now - 60 * 3600 - 17 * 60, now, 60);       // hours, unaligned
+   CheckQuery(ring, samples, raw, now - 3 * 20 * 3600 - 1234, now, 20);      // hours, 3 per point
+   CheckQuery(ring, samples, raw, now - 12 * 86400, now, 12);                // days
+   CheckQuery(ring, samples, raw, now - 12 * 86400 - 5 * 3600, now, 12);     // days, unaligned
+   CheckQuery(ring, samples, raw, now - 40 * 86400, now, 20);                // days, 2 per point
+}
+
+int main()
+{
+   HistoryRing         ring(BLOCKS);
+   std::vector<Sample> samples;
+   time_t              begin = 1660000000;
+   HistoryPoint        points[1];
+
+   srand(42);
+   AppendSeries(ring, samples, begin, begin + DAYS * 86400);
+   CHECK(ring.Blocks() == BLOCKS);
+   CHECK(ring.Count() < (int) samples.size()); // the oldest blocks were dropped
+   CheckBlocks(ring, samples);
+   CheckQueries(ring, samples, samples);
+
+   ring.Query(begin, begin + 86400, 0, points);
+   CHECK(ring.Count() > 0);
+
+   // The clock goes back three days: the blocks start again, the tiers keep their buckets
+   std::vector<Sample> raw;
+   time_t              back = samples.back().time - 3 * 86400;
+
+   AppendSeries(ring, raw, back, back + 86400 / 2);
+   samples.insert(samples.end(), raw.begin(), raw.end());
+   CHECK(ring.Count() <= (int) raw.size());
+   CheckBlocks(ring, raw);
+   CheckQueries(ring, samples, raw);
+
+   return CheckResult("history_test");
+}
@@ -0,0 +1,248 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file mqtt_broker.cpp
+  * 
+  * Stand-in for the MQTT broker of PV_SOURCE_MQTT (MQTTData.h): a minimal
+  * MQTT 3.1.1 broker with QoS 0 and retained messages only. It starts with
+  * the retained messages of a file, one "topic payload" per line, and keeps
+  * every retained PUBLISH of a client. A SUBSCRIBE is answered with the 
+  * retained message of the topic, wildcards are not supported. Point 
+  * MQTT_SERVER at it to run the dashboard without the real installation.
+  *
+  * Usage: mqtt_broker [-p port] retained.txt
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <map>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_SUBACK      0x90
+#define MQTT_PINGREQ     0xc0
+#define MQTT_PINGRESP    0xd0
+#define MQTT_DISCONNECT  0xe0
+#define MQTT_RETAIN      0x01
+#define MQTT_MAX_CLIENTS 8
+
+static std::map<std::string, std::string> retained; // topic -> payload
+
+/* Read exactly size bytes, false if the client is gone. */
+static bool ReadAll(int sock, void *data, size_t size)
+{
+   return size == 0 || recv(sock, data, size, MSG_WAITALL) == (ssize_t) size;
+}
+
+/* Send a packet with its fixed header. */
+static bool SendPacket(int sock, uint8_t type, const std::string &body)
+{
+   std::string packet(1, (char) type);
+   size_t      length = body.size();
+
+   do {
+      uint8_t digit = length % 128;
+
+      length /= 128;
+      packet += (char) (length ? digit | 0x80 : digit);
+   } while (length);
+   packet += body;
+   return send(sock, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t) packet.size();
+}
+
+/* A 16 bit length prefixed string of an MQTT packet. */
+static std::string Utf8(const std::string &text)
+{
+   return std::string(1, (char) (text.size() >> 8)) + (char) (text.size() & 0xff) + text;
+}
+
+/* Read the string at pos of body, advances pos. */
+static std::string ReadUtf8(const std::string &body, size_t &pos)
+{
+   if (pos + 2 > body.size()) {
+      pos = body.size();
+      return "";
+   }
+   size_t length = ((uint8_t) body[pos] << 8) | (uint8_t) body[pos + 1];
+   size_t start  = pos + 2;
+
+   pos = start + length <= body.size() ? start + length : body.size();
+   return body.substr(start, pos - start);
+}
+
+/* Handle one packet of a client, false to close the connection. */
+static bool HandlePacket(int sock)
+{
+   uint8_t     type;
+   uint8_t     digit;
+   size_t      length = 0;
+   std::string body;
+
+   if (!ReadAll(sock, &type, 1)) {
+      return false;
+   }
+   for (int shift = 0; shift < 28; shift += 7) {
+      if (!ReadAll(sock, &digit, 1)) {
+         return false;
+      }
+      length |= (size_t) (digit & 0x7f) << shift;
+      if (!(digit & 0x80)) {
+         break;
+      }
+   }
+   body.resize(length);
+   if (!ReadAll(sock, &body[0], length)) {
+      return false;
+   }
+   switch (type & 0xf0) {
+      case MQTT_CONNECT:
+         return SendPacket(sock, MQTT_CONNACK, std::string("\0\0", 2));
+      case MQTT_PUBLISH: {
+         size_t      pos   = 0;
+         std::string topic = ReadUtf8(body, pos);
+
+         if (type & 0x06) {
+            return false; // QoS 1 and 2 are not supported
+         }
+         if (type & MQTT_RETAIN) {
+            retained[topic] = body.substr(pos);
+            printf("retained %s = %s\n", topic.c_str(), body.substr(pos).c_str());
+         }
+         return true;
+      }
+      case MQTT_SUBSCRIBE & 0xf0: {
+         size_t      pos    = 2;
+         std::string suback = body.substr(0, 2);
+
+         while (pos < body.size()) {
+            ReadUtf8(body, pos);
+            pos++; // requested QoS
+            suback += '\0';
+         }
+         if (!SendPacket(sock, MQTT_SUBACK, suback)) {
+            return false;
+         }
+         for (pos = 2; pos < body.size(); pos++) {
+            std::string topic = ReadUtf8(body, pos);
+
+            if (retained.count(topic) && !SendPacket(sock, MQTT_PUBLISH | MQTT_RETAIN, Utf8(topic) + retained[topic])) {
+               return false;
+            }
+         }
+         return true;
+      }
+      case MQTT_PINGREQ:
+         return SendPacket(sock, MQTT_PINGRESP, "");
+      default:
+         return false; // MQTT_DISCONNECT and the unsupported packets
+   }
+}
+
+/* Load the retained messages, one "topic payload" per line. */
+static bool LoadRetained(const char *path)
+{
+   FILE *file = fopen(path, "r");
+   char  line[512];
+
+   if (!file) {
+      return false;
+   }
+   while (fgets(line, sizeof(line), file)) {
+      char *space = strchr(line, ' ');
+
+      line[strcspn(line, "\r\n")] = 0;
+      if (space && line[0] != '#') {
+         *space = 0;
+         retained[line] = space + 1;
+      }
+   }
+   fclose(file);
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   int         port    = 1883;
+   const char *path    = NULL;
+   int         clients[MQTT_MAX_CLIENTS];
+   int         count   = 0;
+   int         opt;
+
+   while ((opt = getopt(argc, argv, "p:")) != -1) {
+      if (opt == 'p') {
+         port = atoi(optarg);
+      }
+   }
+   path = optind < argc ? argv[optind] : NULL;
+   if (!path || !LoadRetained(path)) {
+      fprintf(stderr, "usage: %s [-p port] retained.txt\n", argv[0]);
+      return 2;
+   }
+   int         server = socket(AF_INET, SOCK_STREAM, 0);
+   int         on     = 1;
+   sockaddr_in addr;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port        = htons(port);
+   setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+   if (bind(server, (const sockaddr *) &addr, sizeof(addr)) < 0 || listen(server, 4) < 0) {
+      perror("mqtt_broker");
+      return 1;
+   }
+   printf("mqtt_broker: %zu retained topics on port %d\n", retained.size(), port);
+   fflush(stdout);
+   for (;;) {
+      fd_set readable;
+      int    last = server;
+
+      FD_ZERO(&readable);
+      FD_SET(server, &readable);
+      for (int i = 0; i < count; i++) {
+         FD_SET(clients[i], &readable);
+         last = clients[i] > last ? clients[i] : last;
+      }
+      if (select(last + 1, &readable, NULL, NULL, NULL) < 0) {
+         continue;
+      }
+      for (int i = count - 1; i >= 0; i--) {
+         if (FD_ISSET(clients[i], &readable) && !HandlePacket(clients[i])) {
+            close(clients[i]);
+            clients[i] = clients[--count];
+         }
+      }
+      if (FD_ISSET(server, &readable)) {
+         int client = accept(server, NULL, NULL);
+
+         if (client >= 0 && count < MQTT_MAX_CLIENTS) {
+            clients[count++] = client;
+         } else if (client >= 0) {
+            close(client);
+         }
+      }
+      fflush(stdout);
+   }
+}
@@ -0,0 +1,236 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file mqtt_loopback.cpp
+  * 
+  * Runs the mqtt_broker stand-in on the loopback interface with a retained
+  * message for every topic of MQTT_TOPICS (Config.h) and plays the session
+  * of GetMQTTValues(): connect, one subscribe per topic and the retained 
+  * messages, which go through MQTTMessageToValues() like in OnMQTTMessage().
+  * The decoded values have to match the retained payloads. Then a retained
+  * update of another client has to reach the next session.
+  *
+  * Usage: mqtt_loopback path/to/mqtt_broker
+  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Check.h"
+#include "Config.h"
+#include "PVSnapshot.h"
+#include "MQTTTopic.h"
+
+
+/* Retained payload of a topic as the installation would publish it. */
+static std::string Payload(size_t topic)
+{
+   char text[32];
+
+   switch (pvSchema[mqttTopics[topic].field].type) {
+      case PV_TYPE_STATE:   return "On-grid";
+      case PV_TYPE_HISTORY: return "[1.5,2.25]";
+      default:              snprintf(text, sizeof(text), "%u", 100 + (unsigned) topic); return text;
+   }
+}
+
+/* Start the broker on port with the retained messages of path. */
+static pid_t StartBroker(const char *broker, const char *path, int port)
+{
+   char  portText[16];
+   pid_t pid = fork();
+
+   snprintf(portText, sizeof(portText), "%d", port);
+   if (pid == 0) {
+      freopen("/dev/null", "w", stdout);
+      execl(broker, broker, "-p", portText, path, (char *) NULL);
+      _exit(127);
+   }
+   return pid;
+}
+
+/* TCP connection to the broker, -1 if it does not listen within 3 s. */
+static int Connect(int port)
+{
+   sockaddr_in to;
+   timeval     timeout = { 0, 500000 };
+
+   memset(&to, 0, sizeof(to));
+   to.sin_family      = AF_INET;
+   to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   to.sin_port        = htons(port);
+   for (int i = 0; i < 30; i++) {
+      int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+      if (connect(sock, (const sockaddr *) &to, sizeof(to)) == 0) {
+         setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+         return sock;
+      }
+      close(sock);
+      usleep(100000);
+   }
+   return -1;
+}
+
+static std::string Utf8(const std::string &text)
+{
+   return std::string(1, (char) (text.size() >> 8)) + (char) (text.size() & 0xff) + text;
+}
+
+static void SendPacket(int sock, uint8_t type, const std::string &body)
+{
+   std::string packet(1, (char) type);
+
+   packet += (char) body.size(); // the test packets are shorter than 128 bytes
+   packet += body;
+   send(sock, packet.data(), packet.size(), MSG_NOSIGNAL);
+}
+
+/* Read one packet, false on a timeout. */
+static bool ReadPacket(int sock, uint8_t &type, std::string &body)
+{
+   uint8_t digit;
+   size_t  length = 0;
+
+   if (recv(sock, &type, 1, MSG_WAITALL) != 1) {
+      return false;
+   }
+   for (int shift = 0; shift < 28; shift += 7) {
+      if (recv(sock, &digit, 1, MSG_WAITALL) != 1) {
+         return false;
+      }
+      length |= (size_t) (digit & 0x7f) << shift;
+      if (!(digit & 0x80)) {
+         break;
+      }
+   }
+   body.resize(length);
+   return length == 0 || recv(sock, &body[0], length, MSG_WAITALL) == (ssize_t) length;
+}
+
+/* MQTT 3.1.1 CONNECT with a clean session, true on an accepted CONNACK. */
+static bool Hello(int sock, const char *client)
+{
+   uint8_t     type;
+   std::string body;
+
+   SendPacket(sock, 0x10, Utf8("MQTT") + std::string("\x04\x02\x00\x0f", 4) + Utf8(client));
+   return ReadPacket(sock, type, body) && type == 0x20 && body.size() == 2 && body[1] == 0;
+}
+
+/* The session of GetMQTTValues(), the retained messages stored into values. */
+static bool Session(int port, PVValues &values)
+{
+   int      sock     = Connect(port);
+   uint32_t received = 0;
+   uint32_t all      = (uint32_t) ((1ULL << MQTT_TOPIC_COUNT) - 1);
+   uint8_t  type;
+
+   if (sock < 0 || !Hello(sock, MQTT_CLIENT)) {
+      return false;
+   }
+   values.mask = 0;
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      SendPacket(sock, 0x82, std::string(1, 0) + (char) (i + 1) + Utf8(mqttTopics[i].topic) + '\0');
+   }
+   for (std::string body; received != all && ReadPacket(sock, type, body); ) {
+      size_t      pos   = 2;
+      std::string topic = body.substr(2, ((uint8_t) body[0] << 8) | (uint8_t) body[1]);
+
+      if (type != (0x30 | 0x01)) {
+         continue; // SUBACK, a publish without retain is not expected
+      }
+      pos += topic.size();
+      received |= MQTTMessageToValues(topic.c_str(), (const uint8_t *) body.data() + pos, body.size() - pos, values);
+   }
+   SendPacket(sock, 0xe0, "");
+   close(sock);
+   return received == all;
+}
+
+int main(int argc, char *argv[])
+{
+   char        path[] = "/tmp/mqtt_loopbackXXXXXX";
+   int         port   = 20000 + getpid() % 20000;
+   PVValues    values;
+   FILE       *file;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s mqtt_broker\n", argv[0]);
+      return 2;
+   }
+   close(mkstemp(path));
+   file = fopen(path, "w");
+   fprintf(file, "# retained messages of the loopback test\n");
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      fprintf(file, "%s %s\n", mqttTopics[i].topic, Payload(i).c_str());
+   }
+   fclose(file);
+
+   pid_t pid = StartBroker(argv[1], path, port);
+
+   // every configured topic has its retained message, decoded into its PVField
+   memset(&values, 0, sizeof(values));
+   for (int i = 0; i < MAX_PV_HISTORY; i++) {
+      values.historyPower[i] = values.historyYeld[i] = 7; // the entries after the short array are cleared
+   }
+   CHECK(Session(port, values));
+   for (size_t i = 0; i < MQTT_TOPIC_COUNT; i++) {
+      int field = mqttTopics[i].field;
+
+      CHECK(values.mask & (1UL << field));
+      switch (pvSchema[field].type) {
+         case PV_TYPE_STATE:
+            CHECK(FveStateFromString(values.fveState) == FVE_ON_GRID);
+            break;
+         case PV_TYPE_HISTORY:
+            CHECK(PVValuesHistory(values, field)[0] == 1.5f && PVValuesHistory(values, field)[1] == 2.25f);
+            for (int h = 2; h < MAX_PV_HISTORY; h++) {
+               CHECK(PVValuesHistory(values, field)[h] == 0);
+            }
+            break;
+         default:
+            CHECK(values.scalar[field] == 100 + i);
+            break;
+      }
+   }
+   CHECK(MQTTMessageToValues("not/configured", (const uint8_t *) "1", 1, values) == 0);
+
+   // the installation publishes a new retained value, the next wake reads it
+   int sock = Connect(port);
+
+   CHECK(sock >= 0 && Hello(sock, "loopback-publisher"));
+   SendPacket(sock, 0x30 | 0x01, Utf8(mqttTopics[0].topic) + "1750");
+   SendPacket(sock, 0xe0, "");
+   close(sock);
+   usleep(100000);
+   CHECK(Session(port, values));
+   CHECK(values.scalar[mqttTopics[0].field] == 1750);
+   CHECK(values.scalar[mqttTopics[1].field] == 101);
+
+   kill(pid, SIGTERM);
+   waitpid(pid, NULL, 0);
+   unlink(path);
+   return CheckResult("mqtt_loopback");
+}
@@ -0,0 +1,159 @@
+/*
+   Copyright (C) 2022 SFini
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+  * @file record_log_test.cpp
+  * 
+  * Checks RecordLog.h on a RecordLogFile: many wakes with compactions, 
+  * unchanged records which are not written again, and power losses in 
+  * the middle of a commit and of a compaction, after which the records
+  * of the last complete batch have to be read.
+  */
+#include <stdio.h>
+#include <unistd.h>
+#include "Check.h"
+#include "RecordLog.h"
+
+
+#define LOG_SIZE (4 * RECORD_LOG_SECTOR)
+
+/**
+  * RecordLogFile which loses the power after a number of written bytes.
+  */
+class PowerLossFile : public RecordLogFile
+{
+public:
+   long budget; //!< Bytes until the power loss, -1 for never
+
+   PowerLossFile(const char *path)
+      : RecordLogFile(path, LOG_SIZE)
+      , budget(-1)
+   {
+   }
+
+   bool Write(uint32_t offset, const void *data, size_t size) override
+   {
+      if (budget >= 0 && (long) size > budget) {
+         RecordLogFile::Write(offset, data, budget);
+         budget = 0;
+         return false;
+      }
+      if (budget >= 0) {
+         budget -= size;
+      }
+      return RecordLogFile::Write(offset, data, size);
+   }
+};
+
+/* One wake: the counter, a history which changes and a constant record. */
+static bool Wake(RecordLog &log, int counter)
+{
+   uint8_t history[600];
+   int     constant = 7;
+
+   memset(history, counter, sizeof(history));
+   return log.Save("counter", 1, &counter, sizeof(counter)) &&
+          log.Save("history", 3, history, sizeof(history)) &&
+          log.Save("const", 1, &constant, sizeof(constant)) &&
+          log.Commit();
+}
+
+/* Counter and history of a reopened log, -1 if they are missing or differ. */
+static int Reopen(const char *path)
+{
+   PowerLossFile file(path);
+   RecordLog     log;
+   uint8_t       history[600];
+   int           counter  = -1;
+   int           constant = 0;
+
+   if (!log.Open(file) || !log.Load("counter", 1, &counter, sizeof(counter)) ||
+       !log.Load("history", 3, history, sizeof(history)) || history[599] != (uint8_t) counter ||
+       !log.Load("const", 1, &constant, sizeof(constant)) || constant != 7) {
+      return -1;
+   }
+   return counter;
+}
+
+int main()
+{
+   char path[] = "/tmp/record_logXXXXXX";
+
+   close(mkstemp(path));
+   unlink(path);
+
+   // 200 wakes, the banks are compacted again and again
+   {
+      PowerLossFile file(path);
+      RecordLog     log;
+      int           version;
+
+      CHECK(log.Open(file));
+      for (int wake = 0; wake < 200; wake++) {
+         CHECK(Wake(log, wake));
+      }
+      CHECK(log.Generation() > 2);
+      CHECK(!log.Load("history", 2, &version, sizeof(version)));
+
+      // an unchanged record is not written
+      uint32_t used     = log.Used();
+      int      constant = 7;
+
+      CHECK(log.Save("const", 1, &constant, sizeof(constant)) && log.Commit() && log.Used() == used);
+   }
+   CHECK(Reopen(path) == 199);
+
+   // power loss at every 7th byte of a commit: the previous batch or the new one is read
+   for (long budget = 0; budget < 700; budget += 7) {
+      {
+         PowerLossFile file(path);
+         RecordLog     log;
+
+         CHECK(log.Open(file));
+         file.budget = budget;
+         Wake(log, 200);
+      }
+      int counter = Reopen(path);
+
+      CHECK(counter == 199 || counter == 200);
+      PowerLossFile file(path);
+      RecordLog     log;
+
+      CHECK(log.Open(file) && Wake(log, 199));
+   }
+   CHECK(Reopen(path) == 199);
+
+   // power loss during a compaction
+   {
+      PowerLossFile file(path);
+      RecordLog     log;
+      int           wake = 300;
+
+      CHECK(log.Open(file) && Wake(log, wake));
+      while (log.Used() + 1000 <= log.BankSize()) {
+         CHECK(Wake(log, ++wake));
+      }
+      uint32_t generation = log.Generation();
+
+      file.budget = 300; // the next commit compacts
+      CHECK(!Wake(log, wake + 1));
+      CHECK(log.Generation() == generation);
+      CHECK(Reopen(path) == wake);
+   }
+
+   unlink(path);
+   return CheckResult("record_log_test");
+}